@@ -12,6 +12,7 @@ cd build
 clang++ \
   -O0 -g \
   -std=c++11 \
+  -pthread \
   -Wno-c++11-compat-deprecated-writable-strings \
   -Wno-writable-strings \
   -I../third_party/ -I../imgui \
@@ -0,0 +1,312 @@
+// archive.h
+//
+// Compact, columnar format for long-term storage of records.
+//
+// Records are cut into blocks of ARCHIVE_BLOCK_RECORDS. Inside a block each
+// column is encoded on its own:
+//
+//   timestamps: first value, first delta, then delta-of-deltas, all as
+//               zigzag varints. Pomodoros a regular distance apart cost a
+//               byte or two each.
+//   elapsed:    a dictionary of the distinct values followed by runs of
+//               (dictionary index, run length) varints. Nearly every record
+//               is 300, 1500 or 1800, so most runs are a couple of bytes.
+//
+// The file ends with one ArchiveBlockFooter per block holding the block's
+// position, count, checksum, timestamp range and elapsed sum, followed by an
+// ArchiveTrailer. archive_read checks every decoded block against its footer.
+//
+// This is an export format, written by `solanum export`. Solanum itself never
+// reads archives back; its own history stays in the snapshot and journal.
+// archive_read is what the tests decode an export with, and what a reader
+// elsewhere should do.
+//
+//   ArchiveHeader
+//   block data ...
+//   ArchiveBlockFooter footers[num_blocks]
+//   ArchiveTrailer
+
+#pragma once
+
+#define ARCHIVE_MAGIC 0x43524153  // "SARC"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_BLOCK_RECORDS 4096
+// Worst case for one encoded block: every varint at its longest.
+#define ARCHIVE_MAX_BLOCK_BYTES (ARCHIVE_BLOCK_RECORDS * (10 + 3 + 3 + 3) + 16)
+
+struct ArchiveHeader {
+    uint32 magic;
+    uint32 version;
+};
+
+struct ArchiveBlockFooter {
+    int64 offset;         // Byte offset of the block data in the file.
+    int64 min_timestamp;
+    int64 max_timestamp;
+    int64 elapsed_sum;
+    uint32 size;          // Bytes of block data.
+    uint32 count;         // Records in the block.
+    uint32 crc;           // CRC32C of the block data.
+    uint32 reserved;
+};
+
+struct ArchiveTrailer {
+    int64 num_records;
+    int64 num_blocks;
+    uint32 footers_crc;
+    uint32 magic;
+};
+
+static uint8*
+archive_put_varint(uint8* out, uint64 value) {
+    while (value >= 0x80) {
+        *out++ = (uint8)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8)value;
+    return out;
+}
+
+static uint8*
+archive_put_signed(uint8* out, int64 value) {
+    return archive_put_varint(out, ((uint64)value << 1) ^ (uint64)(value >> 63));
+}
+
+// Returns NULL when the varint runs past end.
+static const uint8*
+archive_get_varint(const uint8* in, const uint8* end, uint64* value) {
+    uint64 result = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        uint8 byte = *in++;
+        result |= (uint64)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return in;
+        }
+    }
+    return NULL;
+}
+
+static const uint8*
+archive_get_signed(const uint8* in, const uint8* end, int64* value) {
+    uint64 raw = 0;
+    in = archive_get_varint(in, end, &raw);
+    *value = (int64)(raw >> 1) ^ -(int64)(raw & 1);
+    return in;
+}
+
+// Encodes count records into out. dict_slots is scratch space of 1 << 16
+// entries, all -1 on entry and on return. Returns the encoded size.
+static size_t
+archive_encode_block(const TimeRecord* records, uint32 count, int32* dict_slots, uint8* out) {
+    uint8* cursor = out;
+
+    int64 prev = 0;
+    int64 prev_delta = 0;
+    for (uint32 i = 0; i < count; ++i) {
+        int64 t = records[i].timestamp;
+        if (i == 0) {
+            cursor = archive_put_signed(cursor, t);
+        }
+        else {
+            int64 delta = t - prev;
+            cursor = archive_put_signed(cursor, i == 1 ? delta : delta - prev_delta);
+            prev_delta = delta;
+        }
+        prev = t;
+    }
+
+    int16 dict[ARCHIVE_BLOCK_RECORDS];
+    uint32 dict_size = 0;
+    for (uint32 i = 0; i < count; ++i) {
+        int32* slot = &dict_slots[(uint16)records[i].elapsed];
+        if (*slot < 0) {
+            *slot = (int32)dict_size;
+            dict[dict_size++] = records[i].elapsed;
+        }
+    }
+    cursor = archive_put_varint(cursor, dict_size);
+    for (uint32 i = 0; i < dict_size; ++i) {
+        cursor = archive_put_signed(cursor, dict[i]);
+    }
+    for (uint32 i = 0; i < count;) {
+        uint32 run = 1;
+        while (i + run < count && records[i + run].elapsed == records[i].elapsed) {
+            ++run;
+        }
+        cursor = archive_put_varint(cursor, (uint64)dict_slots[(uint16)records[i].elapsed]);
+        cursor = archive_put_varint(cursor, run);
+        i += run;
+    }
+
+    for (uint32 i = 0; i < dict_size; ++i) {
+        dict_slots[(uint16)dict[i]] = -1;
+    }
+    return (size_t)(cursor - out);
+}
+
+static bool32
+archive_decode_block(const uint8* in, size_t size, uint32 count, TimeRecord* records) {
+    const uint8* end = in + size;
+    int64 prev = 0;
+    int64 delta = 0;
+    for (uint32 i = 0; i < count; ++i) {
+        int64 value = 0;
+        in = archive_get_signed(in, end, &value);
+        if (!in) {
+            return false;
+        }
+        if (i == 0) {
+            prev = value;
+        }
+        else {
+            delta = i == 1 ? value : delta + value;
+            prev += delta;
+        }
+        records[i].timestamp = prev;
+    }
+
+    uint64 dict_size = 0;
+    in = archive_get_varint(in, end, &dict_size);
+    if (!in || dict_size > ARCHIVE_BLOCK_RECORDS) {
+        return false;
+    }
+    int16 dict[ARCHIVE_BLOCK_RECORDS];
+    for (uint64 i = 0; i < dict_size; ++i) {
+        int64 value = 0;
+        in = archive_get_signed(in, end, &value);
+        if (!in) {
+            return false;
+        }
+        dict[i] = (int16)value;
+    }
+    for (uint32 i = 0; i < count;) {
+        uint64 dict_index = 0;
+        uint64 run = 0;
+        in = archive_get_varint(in, end, &dict_index);
+        in = in ? archive_get_varint(in, end, &run) : NULL;
+        if (!in || dict_index >= dict_size || run == 0 || run > count - i) {
+            return false;
+        }
+        for (uint64 j = 0; j < run; ++j) {
+            records[i++].elapsed = dict[dict_index];
+        }
+    }
+    return in == end;
+}
+
+// Whether decoded records have the count, timestamp range and elapsed sum
+// their footer says.
+static bool32
+archive_block_matches(const ArchiveBlockFooter* footer, const TimeRecord* records) {
+    int64 min_timestamp = footer->count ? records[0].timestamp : 0;
+    int64 max_timestamp = min_timestamp;
+    int64 elapsed_sum = 0;
+    for (uint32 i = 0; i < footer->count; ++i) {
+        int64 t = records[i].timestamp;
+        min_timestamp = t < min_timestamp ? t : min_timestamp;
+        max_timestamp = t > max_timestamp ? t : max_timestamp;
+        elapsed_sum += records[i].elapsed;
+    }
+    return min_timestamp == footer->min_timestamp && max_timestamp == footer->max_timestamp &&
+           elapsed_sum == footer->elapsed_sum;
+}
+
+static bool32
+archive_write(FILE* fd, const TimeRecord* records, int64 num_records) {
+    int64 num_blocks = (num_records + ARCHIVE_BLOCK_RECORDS - 1) / ARCHIVE_BLOCK_RECORDS;
+    ArchiveBlockFooter* footers = (ArchiveBlockFooter*)calloc((size_t)num_blocks + 1, sizeof(ArchiveBlockFooter));
+    int32* dict_slots = (int32*)malloc((1 << 16) * sizeof(int32));
+    uint8* block = (uint8*)malloc(ARCHIVE_MAX_BLOCK_BYTES);
+    bool32 ok = footers && dict_slots && block;
+    if (ok) {
+        memset(dict_slots, 0xff, (1 << 16) * sizeof(int32));
+        ArchiveHeader header = { ARCHIVE_MAGIC, ARCHIVE_VERSION };
+        ok = fwrite(&header, sizeof(header), 1, fd) == 1;
+    }
+    int64 offset = sizeof(ArchiveHeader);
+    for (int64 b = 0; ok && b < num_blocks; ++b) {
+        const TimeRecord* first = records + b * ARCHIVE_BLOCK_RECORDS;
+        int64 left = num_records - b * ARCHIVE_BLOCK_RECORDS;
+        uint32 count = (uint32)(left < ARCHIVE_BLOCK_RECORDS ? left : ARCHIVE_BLOCK_RECORDS);
+
+        ArchiveBlockFooter* footer = &footers[b];
+        footer->offset = offset;
+        footer->count = count;
+        footer->min_timestamp = first[0].timestamp;
+        footer->max_timestamp = first[0].timestamp;
+        for (uint32 i = 0; i < count; ++i) {
+            int64 t = first[i].timestamp;
+            footer->min_timestamp = t < footer->min_timestamp ? t : footer->min_timestamp;
+            footer->max_timestamp = t > footer->max_timestamp ? t : footer->max_timestamp;
+            footer->elapsed_sum += first[i].elapsed;
+        }
+        size_t size = archive_encode_block(first, count, dict_slots, block);
+        footer->size = (uint32)size;
+        footer->crc = crc32c(0, block, size);
+        ok = fwrite(block, 1, size, fd) == size;
+        offset += (int64)size;
+    }
+    if (ok) {
+        ArchiveTrailer trailer = {};
+        trailer.num_records = num_records;
+        trailer.num_blocks = num_blocks;
+        trailer.footers_crc = crc32c(0, footers, (size_t)num_blocks * sizeof(ArchiveBlockFooter));
+        trailer.magic = ARCHIVE_MAGIC;
+        ok = fwrite(footers, sizeof(ArchiveBlockFooter), (size_t)num_blocks, fd) == (size_t)num_blocks &&
+             fwrite(&trailer, sizeof(trailer), 1, fd) == 1;
+    }
+    free(block);
+    free(dict_slots);
+    free(footers);
+    return ok;
+}
+
+// Decodes a whole archive into a malloc'd array of records. Returns NULL if
+// anything in it fails its checksum or disagrees with its footer.
+static TimeRecord*
+archive_read(FILE* fd, int64* out_num_records) {
+    ArchiveHeader header = {};
+    ArchiveTrailer trailer = {};
+    bool32 ok = fread(&header, sizeof(header), 1, fd) == 1 &&
+                header.magic == ARCHIVE_MAGIC && header.version == ARCHIVE_VERSION &&
+                fseek(fd, -(long)sizeof(ArchiveTrailer), SEEK_END) == 0 &&
+                fread(&trailer, sizeof(trailer), 1, fd) == 1 &&
+                trailer.magic == ARCHIVE_MAGIC &&
+                trailer.num_blocks >= 0 && trailer.num_records >= 0 &&
+                trailer.num_records <= trailer.num_blocks * ARCHIVE_BLOCK_RECORDS;
+    if (!ok) {
+        return NULL;
+    }
+    size_t num_blocks = (size_t)trailer.num_blocks;
+    long footers_size = (long)(num_blocks * sizeof(ArchiveBlockFooter));
+    ArchiveBlockFooter* footers = (ArchiveBlockFooter*)malloc(num_blocks * sizeof(ArchiveBlockFooter) + 1);
+    TimeRecord* records = (TimeRecord*)malloc((size_t)trailer.num_records * sizeof(TimeRecord) + 1);
+    uint8* block = (uint8*)malloc(ARCHIVE_MAX_BLOCK_BYTES);
+    ok = footers && records && block &&
+         fseek(fd, -(long)sizeof(ArchiveTrailer) - footers_size, SEEK_END) == 0 &&
+         fread(footers, sizeof(ArchiveBlockFooter), num_blocks, fd) == num_blocks &&
+         crc32c(0, footers, num_blocks * sizeof(ArchiveBlockFooter)) == trailer.footers_crc;
+    int64 at = 0;
+    for (size_t b = 0; ok && b < num_blocks; ++b) {
+        ArchiveBlockFooter* footer = &footers[b];
+        ok = footer->size <= ARCHIVE_MAX_BLOCK_BYTES &&
+             footer->count <= ARCHIVE_BLOCK_RECORDS &&
+             at + footer->count <= trailer.num_records &&
+             fseek(fd, (long)footer->offset, SEEK_SET) == 0 &&
+             fread(block, 1, footer->size, fd) == footer->size &&
+             crc32c(0, block, footer->size) == footer->crc &&
+             archive_decode_block(block, footer->size, footer->count, records + at) &&
+             archive_block_matches(footer, records + at);
+        at += footer->count;
+    }
+    ok = ok && at == trailer.num_records;
+    free(block);
+    free(footers);
+    if (!ok) {
+        free(records);
+        return NULL;
+    }
+    *out_num_records = at;
+    return records;
+}
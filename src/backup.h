@@ -0,0 +1,488 @@
+// backup.h
+//
+// Backup points for solanum.dat.
+//
+// A snapshot is cut into content-defined chunks with a gear rolling hash, so
+// chunk boundaries follow the bytes around them rather than their offsets.
+// Appending records or growing the checksum table only changes the chunks
+// near the change and everything else is shared with earlier backup points.
+// Each chunk is stored once in solanum_backups/chunks/, named by its hashes.
+// A backup point is a small manifest, solanum_backups/<unix time>.man:
+//
+//   BackupManifestHeader
+//   BackupChunkRef chunks[num_chunks]
+//
+// Restoring a point concatenates its chunks in a single pass.
+//
+// The app takes a point when it starts and then about once an hour while
+// records are being logged.
+//
+// Retention keeps the newest point of every hour for a day, of every day for
+// a month and of every week for a year. Chunks that no remaining manifest
+// refers to are deleted, and so are chunk temp files old enough that nothing
+// can still be writing them.
+
+#pragma once
+
+#define BACKUP_MAGIC 0x4b414253  // "SBAK"
+#define BACKUP_VERSION 1
+
+#define BACKUP_MIN_CHUNK (2 * 1024)
+#define BACKUP_MAX_CHUNK (64 * 1024)
+// Top 13 bits of the rolling hash: about 8 KB per chunk on average.
+#define BACKUP_CHUNK_MASK ((uint64)0x1fff << 51)
+
+#define BACKUP_KEEP_HOURLY (24 * 60 * 60)
+#define BACKUP_KEEP_DAILY (30 * 24 * 60 * 60)
+#define BACKUP_KEEP_WEEKLY (365 * 24 * 60 * 60)
+
+// A chunk temp file younger than this may still be being written, by a
+// `solanum restore` taking its safety point or by the app's own backup.
+#define BACKUP_TMP_GRACE_SECONDS (60 * 60)
+
+struct BackupManifestHeader {
+    uint32 magic;
+    uint32 version;
+    int64 timestamp;
+    int64 total_size;
+    int64 num_chunks;
+};
+
+struct BackupChunkRef {
+    uint64 hash;  // FNV-1a
+    uint32 crc;   // CRC32C
+    uint32 size;
+};
+
+static uint64 g_backup_gear[256];
+
+static void
+backup_init_gear() {
+    // splitmix64 with a fixed seed. Changing this changes every chunk boundary.
+    uint64 x = 0x536f6c616e756dull;
+    for (int i = 0; i < 256; ++i) {
+        x += 0x9e3779b97f4a7c15ull;
+        uint64 z = x;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        g_backup_gear[i] = z ^ (z >> 31);
+    }
+}
+
+// Length of the chunk that starts at data.
+static size_t
+backup_next_chunk(const uint8* data, size_t size) {
+    if (size <= BACKUP_MIN_CHUNK) {
+        return size;
+    }
+    if (size > BACKUP_MAX_CHUNK) {
+        size = BACKUP_MAX_CHUNK;
+    }
+    uint64 hash = 0;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash << 1) + g_backup_gear[data[i]];
+        if (i >= BACKUP_MIN_CHUNK && !(hash & BACKUP_CHUNK_MASK)) {
+            return i + 1;
+        }
+    }
+    return size;
+}
+
+static uint64
+backup_hash(const uint8* data, size_t size) {
+    uint64 hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Whether snprintf into a MAX_PATH buffer, which returned n, fit. _snprintf
+// on Windows returns -1 when it didn't.
+static bool32
+backup_path_fits(int n) {
+    return n >= 0 && n < MAX_PATH;
+}
+
+static bool32
+backup_chunk_path(char* path, const char* backup_dir, const BackupChunkRef* ref) {
+    return backup_path_fits(snprintf(path, MAX_PATH, "%s/chunks/%016llx%08x",
+                                     backup_dir, (unsigned long long)ref->hash, ref->crc));
+}
+
+static bool32
+backup_manifest_path(char* path, const char* backup_dir, int64 timestamp) {
+    return backup_path_fits(snprintf(path, MAX_PATH, "%s/%lld.man", backup_dir, (long long)timestamp));
+}
+
+// Reads a whole file into a malloc'd buffer.
+static uint8*
+backup_read_file(const char* path, size_t* out_size) {
+    FILE* fd = fopen(path, "rb");
+    if (!fd) {
+        return NULL;
+    }
+    fseek(fd, 0, SEEK_END);
+    size_t size = (size_t)ftell(fd);
+    fseek(fd, 0, SEEK_SET);
+    uint8* data = (uint8*)malloc(size + 1);
+    if (data && fread(data, 1, size, fd) != size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fd);
+    *out_size = size;
+    return data;
+}
+
+// Writes a file in full through a temp file, so readers never see half of it.
+static bool32
+backup_write_file(const char* path, const void* head, size_t head_size, const void* data, size_t size) {
+    char tmp_path[MAX_PATH];
+    if (!backup_path_fits(snprintf(tmp_path, MAX_PATH, "%s.tmp", path))) {
+        return false;
+    }
+    FILE* fd = fopen(tmp_path, "wb");
+    if (!fd) {
+        return false;
+    }
+    bool32 ok = fwrite(head, 1, head_size, fd) == head_size &&
+                fwrite(data, 1, size, fd) == size;
+    ok = flush_to_disk(fd) && ok;
+    fclose(fd);
+    return ok && replace_file(tmp_path, path);
+}
+
+// Writes a new chunk under a temp name, for backup_take to sync and move
+// into place with the others.
+static bool32
+backup_write_chunk(const char* tmp_path, const uint8* data, size_t size) {
+    FILE* fd = fopen(tmp_path, "wb");
+    if (!fd) {
+        return false;
+    }
+    bool32 ok = fwrite(data, 1, size, fd) == size;
+#ifdef _WIN32
+    ok = flush_to_disk(fd) && ok;
+#endif
+    return fclose(fd) == 0 && ok;
+}
+
+// Adds a backup point for the file at path. Only chunks we have not seen
+// before are written. They are synced all at once before any of them gets
+// its name, and the manifest only after that, so every chunk a manifest on
+// disk refers to is whole.
+static bool32
+backup_take(const char* backup_dir, const char* path, int64 timestamp) {
+    if (!g_backup_gear[0]) {
+        backup_init_gear();
+    }
+    char chunk_dir[MAX_PATH];
+    if (!backup_path_fits(snprintf(chunk_dir, MAX_PATH, "%s/chunks", backup_dir)) ||
+        !make_directory(backup_dir) || !make_directory(chunk_dir)) {
+        return false;
+    }
+
+    size_t size = 0;
+    uint8* data = backup_read_file(path, &size);
+    if (!data) {
+        return false;
+    }
+
+    int64 capacity = 64;
+    int64 num_chunks = 0;
+    int64 num_new = 0;
+    BackupChunkRef* refs = (BackupChunkRef*)malloc((size_t)capacity * sizeof(BackupChunkRef));
+    bool32 ok = refs != NULL;
+    for (size_t offset = 0; ok && offset < size;) {
+        size_t chunk_size = backup_next_chunk(data + offset, size - offset);
+        if (num_chunks == capacity) {
+            capacity *= 2;
+            BackupChunkRef* grown = (BackupChunkRef*)realloc(refs, (size_t)capacity * sizeof(BackupChunkRef));
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            refs = grown;
+        }
+        BackupChunkRef* ref = &refs[num_chunks++];
+        ref->hash = backup_hash(data + offset, chunk_size);
+        ref->crc = crc32c(0, data + offset, chunk_size);
+        ref->size = (uint32)chunk_size;
+
+        char chunk_path[MAX_PATH];
+        char tmp_path[MAX_PATH];
+        ok = backup_chunk_path(chunk_path, backup_dir, ref) &&
+             backup_path_fits(snprintf(tmp_path, MAX_PATH, "%s.tmp", chunk_path));
+        struct stat st;
+        // A chunk only gets its name once it is on disk. A temp file left by a
+        // crash may be partial, so it is written again.
+        if (ok && stat(chunk_path, &st) != 0) {
+            ok = backup_write_chunk(tmp_path, data + offset, chunk_size);
+            ++num_new;
+        }
+        offset += chunk_size;
+    }
+    free(data);
+
+    if (ok && num_new) {
+        flush_file_system(chunk_dir);
+        for (int64 i = 0; ok && i < num_chunks; ++i) {
+            char chunk_path[MAX_PATH];
+            char tmp_path[MAX_PATH];
+            ok = backup_chunk_path(chunk_path, backup_dir, &refs[i]) &&
+                 backup_path_fits(snprintf(tmp_path, MAX_PATH, "%s.tmp", chunk_path));
+            struct stat st;
+            if (ok && stat(tmp_path, &st) == 0) {
+                ok = move_file(tmp_path, chunk_path);
+            }
+        }
+        char chunk_dir_slash[MAX_PATH];
+        if (backup_path_fits(snprintf(chunk_dir_slash, MAX_PATH, "%s/", chunk_dir))) {
+            flush_directory(chunk_dir_slash);
+        }
+    }
+
+    if (ok) {
+        BackupManifestHeader header = {};
+        header.magic = BACKUP_MAGIC;
+        header.version = BACKUP_VERSION;
+        header.timestamp = timestamp;
+        header.total_size = (int64)size;
+        header.num_chunks = num_chunks;
+        char manifest_path[MAX_PATH];
+        ok = backup_manifest_path(manifest_path, backup_dir, timestamp) &&
+             backup_write_file(manifest_path, &header, sizeof(header),
+                               refs, (size_t)num_chunks * sizeof(BackupChunkRef));
+    }
+    free(refs);
+    return ok;
+}
+
+// Returns the chunk list of a manifest in a malloc'd buffer.
+static BackupChunkRef*
+backup_read_manifest(const char* backup_dir, int64 timestamp, BackupManifestHeader* header) {
+    char manifest_path[MAX_PATH];
+    size_t size = 0;
+    uint8* data = backup_manifest_path(manifest_path, backup_dir, timestamp) ?
+            backup_read_file(manifest_path, &size) : NULL;
+    if (!data) {
+        return NULL;
+    }
+    memcpy(header, data, size < sizeof(*header) ? size : sizeof(*header));
+    if (size < sizeof(*header) ||
+        header->magic != BACKUP_MAGIC ||
+        header->version != BACKUP_VERSION ||
+        header->num_chunks < 0 ||
+        size != sizeof(*header) + (size_t)header->num_chunks * sizeof(BackupChunkRef)) {
+        free(data);
+        return NULL;
+    }
+    memmove(data, data + sizeof(*header), size - sizeof(*header));
+    return (BackupChunkRef*)data;
+}
+
+// Rebuilds the backup point `timestamp` at out_path.
+static bool32
+backup_restore(const char* backup_dir, int64 timestamp, const char* out_path) {
+    BackupManifestHeader header;
+    BackupChunkRef* refs = backup_read_manifest(backup_dir, timestamp, &header);
+    if (!refs) {
+        return false;
+    }
+    char tmp_path[MAX_PATH];
+    bool32 fits = backup_path_fits(snprintf(tmp_path, MAX_PATH, "%s.tmp", out_path));
+    FILE* out = fits ? fopen(tmp_path, "wb") : NULL;
+    bool32 ok = out != NULL;
+    uint8* chunk = (uint8*)malloc(BACKUP_MAX_CHUNK);
+    ok = ok && chunk;
+    int64 total_size = 0;
+    for (int64 i = 0; ok && i < header.num_chunks; ++i) {
+        char chunk_path[MAX_PATH];
+        FILE* fd = backup_chunk_path(chunk_path, backup_dir, &refs[i]) ? fopen(chunk_path, "rb") : NULL;
+        ok = fd && refs[i].size <= BACKUP_MAX_CHUNK &&
+             fread(chunk, 1, refs[i].size, fd) == refs[i].size &&
+             crc32c(0, chunk, refs[i].size) == refs[i].crc &&
+             fwrite(chunk, 1, refs[i].size, out) == refs[i].size;
+        if (fd) {
+            fclose(fd);
+        }
+        total_size += refs[i].size;
+    }
+    ok = ok && total_size == header.total_size;
+    if (out) {
+        ok = flush_to_disk(out) && ok;
+        fclose(out);
+    }
+    free(chunk);
+    free(refs);
+    if (ok) {
+        ok = replace_file(tmp_path, out_path);
+    }
+    else if (fits) {
+        remove(tmp_path);
+    }
+    return ok;
+}
+
+struct BackupList {
+    int64* timestamps;
+    int count;
+    int capacity;
+};
+
+static void
+backup_collect_manifest(const char* name, void* user) {
+    BackupList* list = (BackupList*)user;
+    long long timestamp = 0;
+    char suffix[8] = {};
+    if (sscanf(name, "%lld.%4s", &timestamp, suffix) != 2 || strcmp(suffix, "man") != 0) {
+        return;
+    }
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        int64* grown = (int64*)realloc(list->timestamps, (size_t)capacity * sizeof(int64));
+        if (!grown) {
+            return;
+        }
+        list->timestamps = grown;
+        list->capacity = capacity;
+    }
+    list->timestamps[list->count++] = (int64)timestamp;
+}
+
+static int
+backup_compare_newest_first(const void* a, const void* b) {
+    int64 ta = *(const int64*)a;
+    int64 tb = *(const int64*)b;
+    return ta < tb ? 1 : (ta > tb ? -1 : 0);
+}
+
+// Lists backup points, newest first. Free list->timestamps when done.
+static void
+backup_list(const char* backup_dir, BackupList* list) {
+    *list = {};
+    list_directory(backup_dir, backup_collect_manifest, list);
+    if (list->count) {
+        qsort(list->timestamps, (size_t)list->count, sizeof(int64), backup_compare_newest_first);
+    }
+}
+
+struct BackupLiveChunks {
+    BackupChunkRef* refs;
+    int64 count;
+    const char* chunk_dir;
+    int64 now;
+};
+
+static int
+backup_compare_refs(const void* a, const void* b) {
+    const BackupChunkRef* ra = (const BackupChunkRef*)a;
+    const BackupChunkRef* rb = (const BackupChunkRef*)b;
+    if (ra->hash != rb->hash) {
+        return ra->hash < rb->hash ? -1 : 1;
+    }
+    return ra->crc < rb->crc ? -1 : (ra->crc > rb->crc ? 1 : 0);
+}
+
+static void
+backup_sweep_chunk(const char* name, void* user) {
+    BackupLiveChunks* live = (BackupLiveChunks*)user;
+    size_t length = strlen(name);
+    char path[MAX_PATH];
+    if (!backup_path_fits(snprintf(path, MAX_PATH, "%s/%s", live->chunk_dir, name))) {
+        return;
+    }
+    if (length == 28 && !strcmp(name + 24, ".tmp")) {
+        // Left by a backup that did not finish, unless it is still being
+        // written.
+        struct stat st;
+        if (stat(path, &st) == 0 && live->now - (int64)st.st_mtime > BACKUP_TMP_GRACE_SECONDS) {
+            remove(path);
+        }
+        return;
+    }
+    unsigned long long hash = 0;
+    unsigned int crc = 0;
+    if (length != 24 || sscanf(name, "%16llx%8x", &hash, &crc) != 2) {
+        return;
+    }
+    BackupChunkRef key = {};
+    key.hash = (uint64)hash;
+    key.crc = (uint32)crc;
+    if (!bsearch(&key, live->refs, (size_t)live->count, sizeof(BackupChunkRef), backup_compare_refs)) {
+        remove(path);
+    }
+}
+
+// Drops backup points the retention policy no longer wants, then deletes the
+// chunks nothing refers to.
+static void
+backup_apply_retention(const char* backup_dir, int64 now) {
+    BackupList list;
+    backup_list(backup_dir, &list);
+
+    int num_kept = 0;
+    int64 last_bucket = -1;
+    int64 last_period = 0;
+    for (int i = 0; i < list.count; ++i) {
+        int64 timestamp = list.timestamps[i];
+        int64 age = now - timestamp;
+        int64 period = age < BACKUP_KEEP_HOURLY ? 60 * 60 :
+                       age < BACKUP_KEEP_DAILY ? 24 * 60 * 60 :
+                       age < BACKUP_KEEP_WEEKLY ? 7 * 24 * 60 * 60 : 0;
+        int64 bucket = period ? timestamp / period : -1;
+        // Always keep the newest point. Otherwise one per bucket; the list is
+        // newest first, so the first one we see in a bucket is the one to keep.
+        bool32 keep = i == 0 || (period && (period != last_period || bucket != last_bucket));
+        if (keep) {
+            list.timestamps[num_kept++] = timestamp;
+            last_period = period;
+            last_bucket = bucket;
+        }
+        else {
+            char manifest_path[MAX_PATH];
+            if (backup_manifest_path(manifest_path, backup_dir, timestamp)) {
+                remove(manifest_path);
+            }
+        }
+    }
+
+    BackupLiveChunks live = {};
+    int64 capacity = 0;
+    bool32 ok = true;
+    for (int i = 0; ok && i < num_kept; ++i) {
+        BackupManifestHeader header;
+        BackupChunkRef* refs = backup_read_manifest(backup_dir, list.timestamps[i], &header);
+        if (!refs) {
+            // Can't tell what this one needs. Don't delete anything.
+            ok = false;
+            break;
+        }
+        if (live.count + header.num_chunks > capacity) {
+            capacity = (live.count + header.num_chunks) * 2;
+            BackupChunkRef* grown = (BackupChunkRef*)realloc(live.refs, (size_t)capacity * sizeof(BackupChunkRef));
+            ok = grown != NULL;
+            if (ok) {
+                live.refs = grown;
+            }
+        }
+        if (ok) {
+            memcpy(live.refs + live.count, refs, (size_t)header.num_chunks * sizeof(BackupChunkRef));
+            live.count += header.num_chunks;
+        }
+        free(refs);
+    }
+    char chunk_dir[MAX_PATH];
+    if (ok && backup_path_fits(snprintf(chunk_dir, MAX_PATH, "%s/chunks", backup_dir))) {
+        live.chunk_dir = chunk_dir;
+        live.now = now;
+        if (live.count) {
+            qsort(live.refs, (size_t)live.count, sizeof(BackupChunkRef), backup_compare_refs);
+        }
+        list_directory(chunk_dir, backup_sweep_chunk, &live);
+    }
+    free(live.refs);
+    free(list.timestamps);
+}
@@ -0,0 +1,457 @@
+// bench_solanum.cc
+//
+// Benchmarks for the parts of solanum that have to stay fast on long
+// histories. Runs on a synthetic history and needs no window or GL context:
+// the UI is driven through the ImGui core with a renderer that only counts
+// what it would have drawn.
+//
+//   bench_solanum [num_records]
+
+#include "system_includes.h"
+
+#include <chrono>
+
+// Platform services. The benchmarks never save or grow anything.
+void platform_alert(const char* message) {}
+void platform_quit() {}
+struct TimerState;
+void platform_save_state(TimerState* state);
+bool platform_grow_records(TimerState* state);
+int64_t platform_monotonic_ns();
+int64_t platform_suspended_ns();
+bool platform_save_failed();
+void platform_save_tag_names(TimerState* state);
+
+#include "solanum.h"
+
+void
+platform_save_state(TimerState* state) {
+    state->num_pending_entries = 0;
+}
+
+bool
+platform_grow_records(TimerState* state) {
+    return false;
+}
+
+int64
+platform_monotonic_ns() {
+    using namespace std::chrono;
+    return (int64)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+int64
+platform_suspended_ns() {
+    return 0;
+}
+
+bool
+platform_save_failed() {
+    return false;
+}
+
+void
+platform_save_tag_names(TimerState* state) {}
+
+#define BENCH_DEFAULT_RECORDS (10 * 1000 * 1000)
+#define BENCH_REPEATS 5
+
+static double
+bench_now_ms() {
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+// A merged team history: sessions from many people interleaved, a record
+// every half minute on average, about ten years for the default size.
+static TimeRecord*
+bench_make_history(int64 num_records) {
+    TimeRecord* records = (TimeRecord*)malloc((size_t)num_records * sizeof(TimeRecord));
+    if (!records) {
+        return NULL;
+    }
+    uint64 rng = 0x9e3779b97f4a7c15ull;
+    int64 t = (int64)time(NULL) - num_records * 30;
+    for (int64 i = 0; i < num_records; ++i) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        t += (int64)(rng % 61);
+        records[i].timestamp = t;
+        records[i].elapsed = (int16)(15 * 60 + (rng >> 32) % (10 * 60));
+    }
+    return records;
+}
+
+// Every rollup period rebuilt from scratch, as on a start without a usable
+// rollup file. Best of a few runs.
+static void
+bench_rollups(TimeRecord* records, int64 num_records) {
+    RecordColumns columns = {};
+    RollupTable rollups = {};
+    if (!record_columns_build(&columns, records, NULL, num_records)) {
+        printf("Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    double best = 0;
+    for (int run = 0; run < BENCH_REPEATS; ++run) {
+        double begin = bench_now_ms();
+        rollup_table_build(&rollups, &columns, records, NULL, num_records);
+        double elapsed = bench_now_ms() - begin;
+        if (run == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    printf("rollup_table_build, %lld records\n", (long long)num_records);
+    printf("  %8.2f ms   %6.1f M records/s%s\n", best, num_records / best / 1000.0,
+           rollups.damaged ? "   DAMAGED" : "");
+    rollup_table_free(&rollups);
+    record_columns_free(&columns);
+}
+
+static double
+bench_histogram_kernel(RecordColumnsHistogramFn* fn, RecordColumns* columns, DayTable* days,
+                       int64* sums, int64* expected) {
+    double best = 0;
+    for (int run = 0; run < BENCH_REPEATS; ++run) {
+        memset(sums, 0, (size_t)days->num_days * 2 * sizeof(int64));
+        double begin = bench_now_ms();
+        fn(columns->timestamps, columns->elapsed, columns->count, days->starts, days->num_days,
+           sums, sums + days->num_days);
+        double elapsed = bench_now_ms() - begin;
+        best = run == 0 || elapsed < best ? elapsed : best;
+    }
+    if (memcmp(sums, expected, (size_t)days->num_days * 2 * sizeof(int64))) {
+        printf("   MISMATCH");
+    }
+    return best;
+}
+
+// Seconds and records per local day, as rollup_table_build sums them, over
+// the packed records and over the columns with each kernel this CPU runs.
+static void
+bench_columns(TimeRecord* records, int64 num_records) {
+    RecordColumns columns = {};
+    DayTable days = {};
+    if (!num_records || !record_columns_build(&columns, records, NULL, num_records) ||
+        !day_table_cover(&days, day_local_of(records[0].timestamp),
+                         day_local_of(records[num_records - 1].timestamp) + 1)) {
+        record_columns_free(&columns);
+        return;
+    }
+    struct {
+        const char* name;
+        RecordColumnsHistogramFn* histogram_fn;
+    } kernels[3] = {
+        { "columns, plain", record_columns_histogram_c },
+    };
+    int num_kernels = 1;
+#if RECORD_COLUMNS_HAS_SIMD_PATH
+    if (record_columns_cpu_has_sse42()) {
+        kernels[num_kernels++] = { "columns, SSE4.2", record_columns_histogram_sse42 };
+    }
+    if (record_columns_cpu_has_avx2()) {
+        kernels[num_kernels++] = { "columns, AVX2", record_columns_histogram_avx2 };
+    }
+#endif
+
+    printf("seconds per day, %lld days\n", (long long)days.num_days);
+    int64* expected_sums = (int64*)calloc((size_t)days.num_days * 2, sizeof(int64));
+    int64* sums = (int64*)malloc((size_t)days.num_days * 2 * sizeof(int64));
+    double best = 0;
+    if (expected_sums && sums) {
+        // Through the day table one record at a time, like rollup_table_apply.
+        for (int run = 0; run < BENCH_REPEATS; ++run) {
+            memset(expected_sums, 0, (size_t)days.num_days * 2 * sizeof(int64));
+            double begin = bench_now_ms();
+            for (int64 i = 0; i < num_records; ++i) {
+                int64 day = day_table_day(&days, records[i].timestamp) - days.first;
+                expected_sums[day] += records[i].elapsed;
+                ++expected_sums[days.num_days + day];
+            }
+            double elapsed = bench_now_ms() - begin;
+            best = run == 0 || elapsed < best ? elapsed : best;
+        }
+        printf("  %-20s %8.2f ms   %7.1f M records/s\n", "packed records", best, num_records / best / 1000.0);
+        for (int i = 0; i < num_kernels; ++i) {
+            printf("  %-20s", kernels[i].name);
+            double ms = bench_histogram_kernel(kernels[i].histogram_fn, &columns, &days, sums, expected_sums);
+            printf(" %8.2f ms   %7.1f M records/s\n", ms, num_records / ms / 1000.0);
+        }
+    }
+    free(expected_sums);
+    free(sums);
+    day_table_free(&days);
+    record_columns_free(&columns);
+}
+
+#define BENCH_MERGE_MACHINES 4
+
+// Records the same as an earlier one, in records sorted by timestamp.
+static int64
+bench_count_repeats(TimeRecord* records, int64 num_records) {
+    int64 repeats = 0;
+    for (int64 i = 1; i < num_records; ++i) {
+        for (int64 j = i - 1; j >= 0 && records[j].timestamp == records[i].timestamp; --j) {
+            if (records[j].elapsed == records[i].elapsed) {
+                ++repeats;
+                break;
+            }
+        }
+    }
+    return repeats;
+}
+
+// The history spread over machines the way it would be in the shared
+// directory: each session on one machine, plus the old shared file's first
+// tenth copied on to every machine. Machine 0 is this one.
+static void
+bench_merge(TimeRecord* records, int64 num_records) {
+    int64 num_shared = num_records / 10;
+    TimeRecord* local = (TimeRecord*)malloc((size_t)num_records * sizeof(TimeRecord));
+    int64 num_local = 0;
+    HistoryMerge merge = {};
+    RecordIndex index = {};
+    RollupTable rollups = {};
+    bool32 ok = local != NULL;
+    for (int m = 1; ok && m < BENCH_MERGE_MACHINES; ++m) {
+        char name[16];
+        snprintf(name, sizeof(name), "machine%d", m);
+        MergeSource* source = history_merge_source(&merge, name);
+        ok = source && merge_source_reserve(source, num_records);
+        if (ok) {
+            source->present = true;
+        }
+    }
+    if (!ok) {
+        printf("Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int64 i = 0; i < num_records; ++i) {
+        int m = i < num_shared ? -1 : (int)((uint64)(i * 0x9e3779b97f4a7c15ull) >> 62) % BENCH_MERGE_MACHINES;
+        if (m <= 0) {
+            local[num_local++] = records[i];
+        }
+        for (int s = 0; s < merge.num_sources; ++s) {
+            if (m < 0 || m == s + 1) {
+                MergeSource* source = &merge.sources[s];
+                source->tags[source->num_records] = TAG_NONE;
+                source->records[source->num_records++] = records[i];
+            }
+        }
+    }
+    // Keep the last record of each machine back, to append one at a time.
+    for (int s = 0; s < merge.num_sources; ++s) {
+        --merge.sources[s].num_records;
+    }
+    record_index_build(&index, local, NULL, num_local);
+
+    printf("history_merge_update, %d machines, %lld records\n", BENCH_MERGE_MACHINES, (long long)num_records);
+    double begin = bench_now_ms();
+    history_merge_update(&merge, &index, local, NULL, num_local, &rollups);
+    double ms = bench_now_ms() - begin;
+    int64 num_merged = 0;
+    for (int s = 0; s < merge.num_sources; ++s) {
+        num_merged += merge.sources[s].num_records;
+    }
+    printf("  %-20s %8.2f ms   %7.1f M records/s   %lld kept, %lld dropped\n", "all machines", ms,
+           num_merged / ms / 1000.0, (long long)merge.num_records, (long long)(num_merged - merge.num_records));
+
+    begin = bench_now_ms();
+    for (int s = 0; s < merge.num_sources; ++s) {
+        ++merge.sources[s].num_records;
+        history_merge_update(&merge, &index, local, NULL, num_local, &rollups);
+    }
+    ms = bench_now_ms() - begin;
+    printf("  %-20s %8.2f us per record\n", "one more record", ms * 1000.0 / merge.num_sources);
+    // The made up history has a few sessions twice. They count once, unless
+    // both are this machine's.
+    int64 num_sessions = num_records - bench_count_repeats(records, num_records) +
+            bench_count_repeats(local, num_local);
+    if (num_local + merge.num_records != num_sessions) {
+        printf("  MISMATCH: %lld sessions in the view and here, %lld made\n",
+               (long long)(num_local + merge.num_records), (long long)num_sessions);
+    }
+
+    history_merge_free(&merge);
+    record_index_free(&index);
+    rollup_table_free(&rollups);
+    free(local);
+}
+
+#define BENCH_UI_FRAMES 5000
+#define BENCH_UI_WARMUP_FRAMES 60
+#define BENCH_UI_SMALL_HISTORY 1000
+
+// What the null renderer and allocator saw since the last reset.
+struct BenchUiCounters {
+    int64 allocations;
+    int64 vertices;
+    int64 indices;
+    int64 draw_commands;
+};
+
+static BenchUiCounters g_bench_ui;
+
+static void*
+bench_ui_alloc(size_t size) {
+    ++g_bench_ui.allocations;
+    return malloc(size);
+}
+
+static void
+bench_ui_free(void* ptr) {
+    free(ptr);
+}
+
+static void
+bench_ui_render_draw_lists(ImDrawData* data) {
+    g_bench_ui.vertices += data->TotalVtxCount;
+    g_bench_ui.indices += data->TotalIdxCount;
+    for (int i = 0; i < data->CmdListsCount; ++i) {
+        g_bench_ui.draw_commands += data->CmdLists[i]->CmdBuffer.Size;
+    }
+}
+
+static void
+bench_ui_init() {
+    ImGuiIO& io = ImGui::GetIO();
+    io.MemAllocFn = bench_ui_alloc;
+    io.MemFreeFn = bench_ui_free;
+    io.RenderDrawListsFn = bench_ui_render_draw_lists;
+    io.IniFilename = NULL;
+    io.DisplaySize = {1280, 720};
+    io.DeltaTime = 1.0f / 60.0f;
+    io.MousePos = {-1, -1};
+    unsigned char* pixels;
+    int width;
+    int height;
+    io.Fonts->GetTexDataAsAlpha8(&pixels, &width, &height);
+}
+
+enum BenchUiScene {
+    BenchUiScene_IDLE,
+    BenchUiScene_RUNNING,
+    BenchUiScene_PAUSED,
+    BenchUiScene_EDITING,
+    BenchUiScene_NAMED_TIMERS,
+    BenchUiScene_HUGE_HISTORY,
+    BenchUiScene_CALENDAR,
+    BenchUiScene_COUNT,
+};
+
+static const char* g_bench_ui_scene_names[BenchUiScene_COUNT] = {
+    "idle",
+    "running",
+    "paused after sleep",
+    "editing last entry",
+    "named timers",
+    "idle, full history",
+    "calendar",
+};
+
+// The records are copied, since editing writes to them.
+static bool32
+bench_ui_scene(TimerState* state, BenchUiScene scene, TimeRecord* records, int64 num_records) {
+    *state = {};
+    if (scene != BenchUiScene_HUGE_HISTORY && scene != BenchUiScene_CALENDAR &&
+        num_records > BENCH_UI_SMALL_HISTORY) {
+        records += num_records - BENCH_UI_SMALL_HISTORY;
+        num_records = BENCH_UI_SMALL_HISTORY;
+    }
+    state->records = (TimeRecord*)malloc((size_t)num_records * sizeof(TimeRecord));
+    if (!state->records || !record_index_build(&state->index, records, NULL, num_records)) {
+        return false;
+    }
+    memcpy(state->records, records, (size_t)num_records * sizeof(TimeRecord));
+    rollup_table_build(&state->rollups, &state->columns, state->records, NULL, num_records);
+    state->records_size = (size_t)num_records;
+    state->num_records = num_records;
+    state->time_persp = (int64)time(NULL) - 24 * 60 * 60;
+    state->num_seconds = (int)record_seconds_since_persp(state);
+
+    TimerClock clock = timer_clock_now();
+    switch (scene) {
+        case BenchUiScene_RUNNING: {
+            timer_start(&state->timer, clock);
+        } break;
+        case BenchUiScene_PAUSED: {
+            timer_start(&state->timer, clock);
+            timer_pause(&state->timer, clock);
+            state->timer.paused_by_sleep = true;
+            state->timer.slept_ns = 8 * 60 * 60 * NS_PER_SECOND;
+        } break;
+        case BenchUiScene_EDITING: {
+            state->editing_last_entry = num_records > 0;
+            state->editing_index = num_records - 1;
+            if (num_records > 0) {
+                state->editing_record = state->records[num_records - 1];
+            }
+        } break;
+        case BenchUiScene_NAMED_TIMERS: {
+            for (int i = 0; i < MAX_NAMED_TIMERS; ++i) {
+                named_timer_start(state, "Tea", 1 + i, clock, (int64)time(NULL));
+            }
+        } break;
+        case BenchUiScene_CALENDAR: {
+            state->heatmap.open = true;
+        } break;
+        default: break;
+    }
+    return true;
+}
+
+static void
+bench_ui(TimeRecord* records, int64 num_records) {
+    printf("timer_step_and_render, %d frames\n", BENCH_UI_FRAMES);
+    printf("  %-20s %10s %10s %10s %10s %10s\n", "", "us/frame", "allocs", "vertices", "indices", "commands");
+    bench_ui_init();
+    for (int scene = 0; scene < BenchUiScene_COUNT; ++scene) {
+        TimerState state;
+        if (!bench_ui_scene(&state, (BenchUiScene)scene, records, num_records)) {
+            printf("Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        clock_t begin = 0;
+        for (int frame = 0; frame < BENCH_UI_WARMUP_FRAMES + BENCH_UI_FRAMES; ++frame) {
+            if (frame == BENCH_UI_WARMUP_FRAMES) {
+                g_bench_ui = {};
+                begin = clock();
+            }
+            ImGui::NewFrame();
+            timer_step_and_render(&state);
+            ImGui::Render();
+        }
+        double us = (double)(clock() - begin) * 1e6 / CLOCKS_PER_SEC;
+        printf("  %-20s %10.2f %10.2f %10lld %10lld %10lld\n", g_bench_ui_scene_names[scene],
+               us / BENCH_UI_FRAMES, (double)g_bench_ui.allocations / BENCH_UI_FRAMES,
+               (long long)(g_bench_ui.vertices / BENCH_UI_FRAMES),
+               (long long)(g_bench_ui.indices / BENCH_UI_FRAMES),
+               (long long)(g_bench_ui.draw_commands / BENCH_UI_FRAMES));
+        record_index_free(&state.index);
+        record_columns_free(&state.columns);
+        tags_free(&state.tags);
+        heatmap_free(&state.heatmap);
+        rollup_table_free(&state.rollups);
+        history_merge_free(&state.peers);
+        free(state.records);
+    }
+    ImGui::Shutdown();
+}
+
+int
+main(int argc, char** argv) {
+    solanum_init_kernels();
+    int64 num_records = argc > 1 ? (int64)strtoll(argv[1], NULL, 10) : BENCH_DEFAULT_RECORDS;
+    TimeRecord* records = bench_make_history(num_records);
+    if (!records) {
+        printf("Out of memory.\n");
+        return EXIT_FAILURE;
+    }
+    bench_rollups(records, num_records);
+    bench_columns(records, num_records);
+    bench_merge(records, num_records);
+    bench_ui(records, num_records);
+    free(records);
+    return 0;
+}
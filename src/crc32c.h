@@ -0,0 +1,120 @@
+// crc32c.h
+//
+// CRC32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has it
+// and falls back to a slicing-by-8 table otherwise.
+
+#pragma once
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CRC32C_HAS_SSE42_PATH 1
+#include <nmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CRC32C_TARGET_SSE42
+#else
+#define CRC32C_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+#endif
+
+#define CRC32C_POLY 0x82f63b78u
+
+static uint32 g_crc32c_table[8][256];
+
+typedef uint32 Crc32cFn(uint32 crc, const uint8* data, size_t size);
+static Crc32cFn* g_crc32c_fn;
+
+static uint32
+crc32c_sw(uint32 crc, const uint8* data, size_t size) {
+    crc = ~crc;
+    while (size && ((uintptr_t)data & 7)) {
+        crc = g_crc32c_table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+        --size;
+    }
+    while (size >= 8) {
+        uint32 lo;
+        uint32 hi;
+        memcpy(&lo, data, 4);
+        memcpy(&hi, data + 4, 4);
+        lo ^= crc;
+        crc = g_crc32c_table[7][lo & 0xff] ^
+              g_crc32c_table[6][(lo >> 8) & 0xff] ^
+              g_crc32c_table[5][(lo >> 16) & 0xff] ^
+              g_crc32c_table[4][lo >> 24] ^
+              g_crc32c_table[3][hi & 0xff] ^
+              g_crc32c_table[2][(hi >> 8) & 0xff] ^
+              g_crc32c_table[1][(hi >> 16) & 0xff] ^
+              g_crc32c_table[0][hi >> 24];
+        data += 8;
+        size -= 8;
+    }
+    while (size--) {
+        crc = g_crc32c_table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if CRC32C_HAS_SSE42_PATH
+CRC32C_TARGET_SSE42 static uint32
+crc32c_sse42(uint32 crc, const uint8* data, size_t size) {
+    uint64 crc64 = ~crc;
+    while (size && ((uintptr_t)data & 7)) {
+        crc64 = _mm_crc32_u8((uint32)crc64, *data++);
+        --size;
+    }
+    while (size >= 8) {
+        uint64 word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        size -= 8;
+    }
+    while (size--) {
+        crc64 = _mm_crc32_u8((uint32)crc64, *data++);
+    }
+    return ~(uint32)crc64;
+}
+
+static bool32
+crc32c_cpu_has_sse42() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#endif
+
+// Builds the tables and picks an implementation. Call once at startup, before
+// any thread that checksums starts: the journal, snapshot, backup and tag
+// writers all run crc32c, and nothing orders these writes against them.
+static void
+crc32c_init() {
+    for (uint32 i = 0; i < 256; ++i) {
+        uint32 crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        g_crc32c_table[0][i] = crc;
+    }
+    for (uint32 i = 0; i < 256; ++i) {
+        for (int t = 1; t < 8; ++t) {
+            uint32 prev = g_crc32c_table[t - 1][i];
+            g_crc32c_table[t][i] = g_crc32c_table[0][prev & 0xff] ^ (prev >> 8);
+        }
+    }
+    Crc32cFn* fn = crc32c_sw;
+#if CRC32C_HAS_SSE42_PATH
+    if (crc32c_cpu_has_sse42()) {
+        fn = crc32c_sse42;
+    }
+#endif
+    g_crc32c_fn = fn;
+}
+
+// Continues crc over data. Start with crc = 0.
+static uint32
+crc32c(uint32 crc, const void* data, size_t size) {
+    return g_crc32c_fn(crc, (const uint8*)data, size);
+}
@@ -0,0 +1,231 @@
+// day_table.h
+//
+// Local days, and the table of midnights that maps a timestamp to one.
+//
+// Days are numbered from the Unix epoch in the local calendar: day 0 is
+// 1970-01-01. Finding the day of a timestamp through localtime costs a lock
+// and a walk of the zone rules every time, which adds up to most of the time
+// spent bucketing a long history. Instead the table holds the local midnight
+// of every day in the range the history covers, found once with mktime.
+// Midnights are never more than a day plus the largest change of UTC offset
+// apart, so (t - starts[0]) / DAY_SECONDS is the right day or next to it; only
+// around a skipped or repeated day do we fall back to a binary search.
+//
+// The table grows at either end when asked about a timestamp outside it. It
+// holds whatever the zone rules were when each midnight was found, so after
+// the time zone changes day_table_check_zone has to be called to drop it.
+
+#pragma once
+
+#define DAY_SECONDS (24 * 60 * 60)
+
+// Days checked with one mktime call when filling the table. Two changes of
+// UTC offset that cancel out within this many days are missed.
+#define DAY_TABLE_STRIDE 8
+
+// Days added at least when the table grows, so appending records in time
+// order doesn't grow it one day at a time.
+#define DAY_TABLE_MIN_GROWTH 64
+
+struct DayTable {
+    int64 first;     // Number of the day starting at starts[0].
+    int64 num_days;  // Day first + i is [starts[i], starts[i + 1]).
+    int64 capacity;
+    int64* starts;   // num_days + 1 local midnights.
+};
+
+static int64
+day_floor_div(int64 a, int64 b) {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+// Days from 1970-01-01 to the given date of the proleptic Gregorian calendar.
+static int64
+day_from_civil(int64 year, int month, int day) {
+    year -= month <= 2;
+    int64 era = day_floor_div(year, 400);
+    int64 year_of_era = year - era * 400;
+    int64 day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    int64 day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+// The inverse of day_from_civil. month and day start at 1.
+static void
+day_to_civil(int64 days, int64* year, int* month, int* day) {
+    days += 719468;
+    int64 era = day_floor_div(days, 146097);
+    int64 day_of_era = days - era * 146097;
+    int64 year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    int64 day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    int64 shifted_month = (5 * day_of_year + 2) / 153;
+    *day = (int)(day_of_year - (153 * shifted_month + 2) / 5 + 1);
+    *month = (int)(shifted_month < 10 ? shifted_month + 3 : shifted_month - 9);
+    *year = year_of_era + era * 400 + (*month <= 2);
+}
+
+// 0 is Monday.
+static int
+day_weekday(int64 day) {
+    return (int)(day + 3 - day_floor_div(day + 3, 7) * 7);
+}
+
+// Local midnight at the start of a day, asking the C library. Going through
+// mktime keeps daylight saving changes right.
+static int64
+day_local_start(int64 day) {
+    int64 year;
+    int month;
+    int day_of_month;
+    day_to_civil(day, &year, &month, &day_of_month);
+    struct tm local = {};
+    local.tm_year = (int)(year - 1900);
+    local.tm_mon = month - 1;
+    local.tm_mday = day_of_month;
+    local.tm_isdst = -1;
+    return (int64)mktime(&local);
+}
+
+// The local day t is in, asking the C library.
+static int64
+day_local_of(int64 t) {
+    time_t time = (time_t)t;
+    struct tm local = *localtime(&time);
+    return day_from_civil(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday);
+}
+
+// Fills starts[0] to starts[count] with the midnights of day `first` on.
+//
+// Days are nearly always 24 hours, so we check a whole stride of days with one
+// mktime call and only go day by day when the offset changed.
+static void
+day_table_fill(int64 first, int64 count, int64* starts) {
+    starts[0] = day_local_start(first);
+    for (int64 done = 0; done < count;) {
+        int64 stride = count - done < DAY_TABLE_STRIDE ? count - done : DAY_TABLE_STRIDE;
+        int64 start = starts[done];
+        int64 end = day_local_start(first + done + stride);
+        bool32 regular = end == start + stride * DAY_SECONDS;
+        for (int64 day = 1; day < stride; ++day) {
+            starts[done + day] = regular ? start + day * DAY_SECONDS : day_local_start(first + done + day);
+        }
+        starts[done + stride] = end;
+        done += stride;
+    }
+}
+
+static void
+day_table_free(DayTable* table) {
+    free(table->starts);
+    *table = {};
+}
+
+// Makes the table cover the days [from, to). Returns false when out of memory,
+// leaving the table as it was.
+static bool32
+day_table_cover(DayTable* table, int64 from, int64 to) {
+    int64 first = table->first;
+    int64 end = table->first + table->num_days;
+    if (!table->num_days) {
+        first = from;
+        end = to;
+    }
+    else if (from >= first && to <= end) {
+        return true;
+    }
+    if (from < first) {
+        first = from < first - DAY_TABLE_MIN_GROWTH ? from : first - DAY_TABLE_MIN_GROWTH;
+    }
+    if (to > end) {
+        end = to > end + DAY_TABLE_MIN_GROWTH ? to : end + DAY_TABLE_MIN_GROWTH;
+    }
+    if (end - first + 1 > table->capacity) {
+        int64 capacity = table->capacity ? table->capacity : 1024;
+        while (capacity < end - first + 1) {
+            capacity *= 2;
+        }
+        int64* starts = (int64*)realloc(table->starts, (size_t)capacity * sizeof(int64));
+        if (!starts) {
+            return false;
+        }
+        table->starts = starts;
+        table->capacity = capacity;
+    }
+    if (!table->num_days) {
+        day_table_fill(first, end - first, table->starts);
+    }
+    else {
+        int64 shift = table->first - first;
+        if (shift) {
+            memmove(table->starts + shift, table->starts, (size_t)(table->num_days + 1) * sizeof(int64));
+            day_table_fill(first, shift, table->starts);
+        }
+        int64 old_end = table->first + table->num_days;
+        if (end > old_end) {
+            day_table_fill(old_end, end - old_end, table->starts + (old_end - first));
+        }
+    }
+    table->first = first;
+    table->num_days = end - first;
+    return true;
+}
+
+// Index of the last of starts[0] to starts[count - 1] that is <= t.
+static int64
+day_table_search(int64* starts, int64 count, int64 t) {
+    int64 lo = 0;
+    while (count > 1) {
+        int64 half = count / 2;
+        lo = starts[lo + half] <= t ? lo + half : lo;
+        count -= half;
+    }
+    return lo;
+}
+
+// The local day t is in.
+static int64
+day_table_day(DayTable* table, int64 t) {
+    if (!table->num_days || t < table->starts[0] || t >= table->starts[table->num_days]) {
+        // A day either side of the day in UTC covers every UTC offset.
+        int64 utc_day = day_floor_div(t, DAY_SECONDS);
+        if (!day_table_cover(table, utc_day - 1, utc_day + 2)) {
+            return day_local_of(t);
+        }
+    }
+    int64* starts = table->starts;
+    int64 i = (t - starts[0]) / DAY_SECONDS;
+    i = i < table->num_days ? i : table->num_days - 1;
+    i -= starts[i] > t;
+    i += starts[i + 1] <= t;
+    if (starts[i] > t || starts[i + 1] <= t) {
+        i = day_table_search(starts, table->num_days, t);
+    }
+    return table->first + i;
+}
+
+// Local midnight at the start of a day.
+static int64
+day_table_start(DayTable* table, int64 day) {
+    if (!day_table_cover(table, day, day + 1)) {
+        return day_local_start(day);
+    }
+    return table->starts[day - table->first];
+}
+
+// Asks the C library again about every stride of days in the table and drops
+// it if any midnight moved, which is what a change of time zone looks like.
+// Returns true if it was dropped.
+static bool32
+day_table_check_zone(DayTable* table) {
+    bool32 changed = false;
+    for (int64 i = 0; table->num_days && !changed && i <= table->num_days; i += DAY_TABLE_STRIDE) {
+        changed = day_local_start(table->first + i) != table->starts[i];
+    }
+    if (table->num_days && !changed) {
+        changed = day_local_start(table->first + table->num_days) != table->starts[table->num_days];
+    }
+    if (changed) {
+        day_table_free(table);
+    }
+    return changed;
+}
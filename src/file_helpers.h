@@ -0,0 +1,140 @@
+// file_helpers.h
+//
+// Small wrappers over the file system calls the persistence code needs.
+
+#pragma once
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <dirent.h>
+#endif
+
+static bool32
+flush_to_disk(FILE* fd) {
+    bool32 ok = fflush(fd) == 0;
+#ifdef _WIN32
+    ok = _commit(_fileno(fd)) == 0 && ok;
+#else
+    ok = fsync(fileno(fd)) == 0 && ok;
+#endif
+    return ok;
+}
+
+static void
+truncate_file(FILE* fd, int64 size) {
+    fflush(fd);
+#ifdef _WIN32
+    _chsize_s(_fileno(fd), size);
+#else
+    ftruncate(fileno(fd), (off_t)size);
+#endif
+}
+
+// Makes a rename or a new file in the directory of path durable.
+static void
+flush_directory(const char* path) {
+#ifndef _WIN32
+    char dir[MAX_PATH];
+    strncpy(dir, path, MAX_PATH - 1);
+    dir[MAX_PATH - 1] = '\0';
+    char* slash = strrchr(dir, '/');
+    if (slash) {
+        *slash = '\0';
+    }
+    else {
+        strcpy(dir, ".");
+    }
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+#endif
+}
+
+// Makes what was written to the file system holding path durable, for many
+// files at once. Windows has no such call for ordinary users, so there each
+// file has to be flushed on its own.
+static void
+flush_file_system(const char* path) {
+#if defined(__linux__)
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        syncfs(fd);
+        close(fd);
+    }
+#elif !defined(_WIN32)
+    sync();
+#endif
+}
+
+// Renames without waiting for the directory to reach the disk, for batches
+// that call flush_directory once at the end.
+static bool32
+move_file(const char* from, const char* to) {
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(from, to) == 0;
+#endif
+}
+
+// Atomically puts `from` in place of `to`. `from` must already be on disk;
+// after a crash we see either the old file or the new one, never a mix.
+static bool32
+replace_file(const char* from, const char* to) {
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    if (rename(from, to) != 0) {
+        return false;
+    }
+    flush_directory(to);
+    return true;
+#endif
+}
+
+static bool32
+make_directory(const char* path) {
+#ifdef _WIN32
+    return _mkdir(path) == 0 || errno == EEXIST;
+#else
+    return mkdir(path, 0777) == 0 || errno == EEXIST;
+#endif
+}
+
+typedef void DirEntryFn(const char* name, void* user);
+
+// Calls fn with the name of every file in dir.
+static bool32
+list_directory(const char* dir, DirEntryFn* fn, void* user) {
+#ifdef _WIN32
+    char pattern[MAX_PATH];
+    snprintf(pattern, MAX_PATH, "%s\\*", dir);
+    WIN32_FIND_DATAA find_data;
+    HANDLE handle = FindFirstFileA(pattern, &find_data);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    do {
+        if (!(find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            fn(find_data.cFileName, user);
+        }
+    } while (FindNextFileA(handle, &find_data));
+    FindClose(handle);
+#else
+    DIR* d = opendir(dir);
+    if (!d) {
+        return false;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            fn(entry->d_name, user);
+        }
+    }
+    closedir(d);
+#endif
+    return true;
+}
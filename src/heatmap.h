@@ -0,0 +1,320 @@
+// heatmap.h
+//
+// Calendar of the whole history: one cell per day, one block of 53 weeks by
+// 7 weekdays per year, newest year first, shaded by the time logged that day.
+//
+// The per-day sums are the day series of the rollup tables, which are kept
+// up to date as records change, so nothing here ever walks the records.
+//
+// Ten years are 3650 cells. Rather than emit them every frame, the vertices
+// and indices AddRectFilled produced are kept and copied into the window's
+// draw list on later frames. They are only built again when the sums change
+// or the grid moves: the window was moved, resized or scrolled. Only cells
+// inside the window are built.
+
+#pragma once
+
+#define HEATMAP_CELL 7.0f
+#define HEATMAP_CELL_GAP 1.0f
+#define HEATMAP_WEEKS 54  // Weeks a year touches when they start on Monday.
+#define HEATMAP_NUM_LEVELS 5
+
+// Seconds a day needs for each shade: two, four and eight pomodoros.
+static const int64 g_heatmap_level_seconds[HEATMAP_NUM_LEVELS] = {
+    0, 1, 2 * MINUTES(25), 4 * MINUTES(25), 8 * MINUTES(25),
+};
+
+static const ImVec4 g_heatmap_level_colors[HEATMAP_NUM_LEVELS] = {
+    {0.30f, 0.30f, 0.30f, 1.0f},
+    {0.05f, 0.27f, 0.16f, 1.0f},
+    {0.00f, 0.43f, 0.20f, 1.0f},
+    {0.15f, 0.65f, 0.25f, 1.0f},
+    {0.22f, 0.83f, 0.33f, 1.0f},
+};
+
+struct HeatmapYear {
+    int64 year;
+    int64 jan1;        // Day number of January 1st, as in rollup_table.h.
+    int jan1_weekday;  // 0 is Monday.
+    int num_days;      // 365 or 366.
+    int64 seconds;
+};
+
+struct Heatmap {
+    bool open;
+
+    // The years the day series covers, as of rollups_version.
+    HeatmapYear* years;  // Oldest first.
+    int num_years;
+    int64 total_seconds;
+    bool32 years_valid;
+    uint32 rollups_version;
+
+    // The geometry of the cells and what it was built for.
+    ImDrawVert* vertices;
+    int num_vertices;
+    int vertices_capacity;
+    ImDrawIdx* indices;   // As built, when the first vertex had index base_index.
+    int num_indices;
+    int indices_capacity;
+    unsigned int base_index;
+    bool32 geometry_valid;
+    uint32 geometry_rollups_version;
+    ImVec2 geometry_origin;
+    ImVec2 geometry_clip_min;
+    ImVec2 geometry_clip_max;
+};
+
+static void
+heatmap_free(Heatmap* heatmap) {
+    free(heatmap->years);
+    free(heatmap->vertices);
+    free(heatmap->indices);
+    *heatmap = {};
+}
+
+// Which years the day series covers, where each one's January 1st is, and
+// its total from the month series.
+static void
+heatmap_update_years(Heatmap* heatmap, RollupTable* rollups) {
+    if (heatmap->years_valid && heatmap->rollups_version == rollups->version) {
+        return;
+    }
+    RollupSeries* days = &rollups->series[RollupPeriod_DAY];
+    heatmap->years_valid = true;
+    heatmap->rollups_version = rollups->version;
+    heatmap->num_years = 0;
+    heatmap->total_seconds = 0;
+    if (!days->num_cells) {
+        return;
+    }
+    int64 first_year;
+    int64 last_year;
+    int month;
+    int day;
+    day_to_civil(days->first, &first_year, &month, &day);
+    day_to_civil(days->first + days->num_cells - 1, &last_year, &month, &day);
+    HeatmapYear* years = (HeatmapYear*)realloc(heatmap->years,
+                                               (size_t)(last_year - first_year + 1) * sizeof(HeatmapYear));
+    if (!years) {
+        return;
+    }
+    heatmap->years = years;
+    heatmap->num_years = (int)(last_year - first_year + 1);
+    for (int i = 0; i < heatmap->num_years; ++i) {
+        HeatmapYear* year = &heatmap->years[i];
+        year->year = first_year + i;
+        year->jan1 = day_from_civil(year->year, 1, 1);
+        year->jan1_weekday = day_weekday(year->jan1);
+        year->num_days = (int)(day_from_civil(year->year + 1, 1, 1) - year->jan1);
+        year->seconds = 0;
+        int64 january = (year->year - 1970) * 12;
+        for (int64 number = january; number < january + 12; ++number) {
+            year->seconds += rollup_table_get(rollups, RollupPeriod_MONTH, number).seconds;
+        }
+        heatmap->total_seconds += year->seconds;
+    }
+}
+
+static float
+heatmap_year_height() {
+    return ImGui::GetTextLineHeightWithSpacing() + 7 * (HEATMAP_CELL + HEATMAP_CELL_GAP) + HEATMAP_CELL;
+}
+
+// Top left corner of a day's cell, relative to the grid.
+static ImVec2
+heatmap_cell_pos(Heatmap* heatmap, int year, int64 day) {
+    HeatmapYear* y = &heatmap->years[year];
+    int64 cell = day - y->jan1 + y->jan1_weekday;
+    float block = (float)(heatmap->num_years - 1 - year) * heatmap_year_height();
+    return {(float)(cell / 7) * (HEATMAP_CELL + HEATMAP_CELL_GAP),
+            block + ImGui::GetTextLineHeightWithSpacing() + (float)(cell % 7) * (HEATMAP_CELL + HEATMAP_CELL_GAP)};
+}
+
+static bool32
+heatmap_reserve_geometry(Heatmap* heatmap, int num_vertices, int num_indices) {
+    if (num_vertices > heatmap->vertices_capacity) {
+        ImDrawVert* vertices = (ImDrawVert*)realloc(heatmap->vertices, (size_t)num_vertices * sizeof(ImDrawVert));
+        if (!vertices) {
+            return false;
+        }
+        heatmap->vertices = vertices;
+        heatmap->vertices_capacity = num_vertices;
+    }
+    if (num_indices > heatmap->indices_capacity) {
+        ImDrawIdx* indices = (ImDrawIdx*)realloc(heatmap->indices, (size_t)num_indices * sizeof(ImDrawIdx));
+        if (!indices) {
+            return false;
+        }
+        heatmap->indices = indices;
+        heatmap->indices_capacity = num_indices;
+    }
+    return true;
+}
+
+// Draws the cells that are inside the clip rectangle with AddRectFilled and
+// keeps what that added to the draw list.
+static void
+heatmap_build_geometry(Heatmap* heatmap, RollupTable* rollups, ImDrawList* draw_list,
+                       ImVec2 origin, ImVec2 clip_min, ImVec2 clip_max) {
+    RollupSeries* days = &rollups->series[RollupPeriod_DAY];
+    ImU32 colors[HEATMAP_NUM_LEVELS];
+    for (int level = 0; level < HEATMAP_NUM_LEVELS; ++level) {
+        colors[level] = ImGui::ColorConvertFloat4ToU32(g_heatmap_level_colors[level]);
+    }
+    int vtx_begin = draw_list->VtxBuffer.Size;
+    int idx_begin = draw_list->IdxBuffer.Size;
+    unsigned int base_index = draw_list->_VtxCurrentIdx;
+    float year_height = heatmap_year_height();
+    for (int year = 0; year < heatmap->num_years; ++year) {
+        HeatmapYear* y = &heatmap->years[year];
+        float top = origin.y + (float)(heatmap->num_years - 1 - year) * year_height;
+        if (top > clip_max.y || top + year_height < clip_min.y) {
+            continue;
+        }
+        int64 begin = y->jan1 > days->first ? y->jan1 : days->first;
+        int64 end = y->jan1 + y->num_days < days->first + days->num_cells ?
+                y->jan1 + y->num_days : days->first + days->num_cells;
+        for (int64 day = begin; day < end; ++day) {
+            ImVec2 pos = heatmap_cell_pos(heatmap, year, day);
+            ImVec2 a = {origin.x + pos.x, origin.y + pos.y};
+            ImVec2 b = {a.x + HEATMAP_CELL, a.y + HEATMAP_CELL};
+            if (b.x < clip_min.x || a.x > clip_max.x || b.y < clip_min.y || a.y > clip_max.y) {
+                continue;
+            }
+            int64 seconds = days->cells[day - days->first].seconds;
+            int level = HEATMAP_NUM_LEVELS - 1;
+            while (level > 0 && seconds < g_heatmap_level_seconds[level]) {
+                --level;
+            }
+            draw_list->AddRectFilled(a, b, colors[level]);
+        }
+    }
+    int num_vertices = draw_list->VtxBuffer.Size - vtx_begin;
+    int num_indices = draw_list->IdxBuffer.Size - idx_begin;
+    if (!heatmap_reserve_geometry(heatmap, num_vertices, num_indices)) {
+        heatmap->geometry_valid = false;
+        return;
+    }
+    memcpy(heatmap->vertices, draw_list->VtxBuffer.Data + vtx_begin, (size_t)num_vertices * sizeof(ImDrawVert));
+    memcpy(heatmap->indices, draw_list->IdxBuffer.Data + idx_begin, (size_t)num_indices * sizeof(ImDrawIdx));
+    heatmap->num_vertices = num_vertices;
+    heatmap->num_indices = num_indices;
+    heatmap->base_index = base_index;
+    heatmap->geometry_valid = true;
+    heatmap->geometry_rollups_version = rollups->version;
+    heatmap->geometry_origin = origin;
+    heatmap->geometry_clip_min = clip_min;
+    heatmap->geometry_clip_max = clip_max;
+}
+
+// Appends the kept geometry to the draw list. The indices only need
+// rewriting when something before the grid drew a different number of
+// vertices than when it was built.
+static void
+heatmap_replay_geometry(Heatmap* heatmap, ImDrawList* draw_list) {
+    if (!heatmap->num_indices) {
+        return;
+    }
+    unsigned int base_index = draw_list->_VtxCurrentIdx;
+    draw_list->PrimReserve(heatmap->num_indices, heatmap->num_vertices);
+    memcpy(draw_list->_VtxWritePtr, heatmap->vertices, (size_t)heatmap->num_vertices * sizeof(ImDrawVert));
+    if (base_index == heatmap->base_index) {
+        memcpy(draw_list->_IdxWritePtr, heatmap->indices, (size_t)heatmap->num_indices * sizeof(ImDrawIdx));
+    }
+    else {
+        for (int i = 0; i < heatmap->num_indices; ++i) {
+            draw_list->_IdxWritePtr[i] = (ImDrawIdx)(heatmap->indices[i] - heatmap->base_index + base_index);
+        }
+    }
+    draw_list->_VtxWritePtr += heatmap->num_vertices;
+    draw_list->_IdxWritePtr += heatmap->num_indices;
+    draw_list->_VtxCurrentIdx += (unsigned int)heatmap->num_vertices;
+}
+
+static bool32
+heatmap_same_pos(ImVec2 a, ImVec2 b) {
+    return a.x == b.x && a.y == b.y;
+}
+
+// Whether pos, relative to the grid, is on a day of the series.
+static bool32
+heatmap_day_at(Heatmap* heatmap, RollupSeries* days, ImVec2 pos, int64* day) {
+    float year_height = heatmap_year_height();
+    int block = (int)(pos.y / year_height);
+    int year = heatmap->num_years - 1 - block;
+    float y = pos.y - (float)block * year_height - ImGui::GetTextLineHeightWithSpacing();
+    if (pos.x < 0 || pos.y < 0 || year < 0 || y < 0) {
+        return false;
+    }
+    int row = (int)(y / (HEATMAP_CELL + HEATMAP_CELL_GAP));
+    int week = (int)(pos.x / (HEATMAP_CELL + HEATMAP_CELL_GAP));
+    if (row >= 7 || week >= HEATMAP_WEEKS) {
+        return false;
+    }
+    HeatmapYear* y_info = &heatmap->years[year];
+    int64 day_of_year = (int64)week * 7 + row - y_info->jan1_weekday;
+    *day = y_info->jan1 + day_of_year;
+    return day_of_year >= 0 && day_of_year < y_info->num_days &&
+            *day >= days->first && *day < days->first + days->num_cells;
+}
+
+static void
+heatmap_render(Heatmap* heatmap, RollupTable* rollups) {
+    if (!heatmap->open) {
+        return;
+    }
+    heatmap_update_years(heatmap, rollups);
+    RollupSeries* days = &rollups->series[RollupPeriod_DAY];
+
+    char buffer[64];
+    ImGui::SetNextWindowPos({10, 10}, ImGuiSetCond_FirstUseEver);
+    ImGui::SetNextWindowSize({470, 320}, ImGuiSetCond_FirstUseEver);
+    if (!ImGui::Begin("Calendar", &heatmap->open)) {
+        ImGui::End();
+        return;
+    }
+    ImGui::Text("%lldh over %lld days", (long long)(heatmap->total_seconds / (60 * 60)),
+                (long long)days->num_cells);
+
+    ImDrawList* draw_list = ImGui::GetWindowDrawList();
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImVec2 clip_min = ImGui::GetWindowPos();
+    ImVec2 window_size = ImGui::GetWindowSize();
+    ImVec2 clip_max = {clip_min.x + window_size.x, clip_min.y + window_size.y};
+    float year_height = heatmap_year_height();
+    ImU32 text_color = ImGui::ColorConvertFloat4ToU32(ImGui::GetStyle().Colors[ImGuiCol_Text]);
+    for (int year = 0; year < heatmap->num_years; ++year) {
+        HeatmapYear* y = &heatmap->years[year];
+        ImVec2 pos = {origin.x, origin.y + (float)(heatmap->num_years - 1 - year) * year_height};
+        if (pos.y > clip_max.y || pos.y + year_height < clip_min.y) {
+            continue;
+        }
+        snprintf(buffer, sizeof(buffer), "%lld: %lldh", (long long)y->year, (long long)(y->seconds / (60 * 60)));
+        draw_list->AddText(pos, text_color, buffer);
+    }
+
+    if (heatmap->geometry_valid && heatmap->geometry_rollups_version == rollups->version &&
+        heatmap_same_pos(heatmap->geometry_origin, origin) &&
+        heatmap_same_pos(heatmap->geometry_clip_min, clip_min) &&
+        heatmap_same_pos(heatmap->geometry_clip_max, clip_max)) {
+        heatmap_replay_geometry(heatmap, draw_list);
+    }
+    else {
+        heatmap_build_geometry(heatmap, rollups, draw_list, origin, clip_min, clip_max);
+    }
+
+    ImGui::Dummy({HEATMAP_WEEKS * (HEATMAP_CELL + HEATMAP_CELL_GAP), (float)heatmap->num_years * year_height});
+    if (ImGui::IsItemHovered()) {
+        ImVec2 mouse = ImGui::GetMousePos();
+        int64 day;
+        if (heatmap_day_at(heatmap, days, {mouse.x - origin.x, mouse.y - origin.y}, &day)) {
+            time_t day_start = (time_t)day_table_start(&rollups->days, day);
+            int64 seconds = days->cells[day - days->first].seconds;
+            strftime(buffer, sizeof(buffer), "%a %Y-%m-%d", localtime(&day_start));
+            ImGui::SetTooltip("%s: %lldh %lldm", buffer, (long long)(seconds / (60 * 60)),
+                              (long long)(seconds / 60 % 60));
+        }
+    }
+    ImGui::End();
+}
@@ -0,0 +1,499 @@
+// history_merge.h
+//
+// The records of the other machines sharing the data directory, merged into
+// one timestamp-sorted view next to this machine's own records.
+//
+// Every machine writes only its own solanum-<machine>.dat and .jnl and reads
+// everyone else's. Each other machine is a MergeSource holding its records as
+// that machine wrote them, which is in time order. The view is a k-way merge
+// of the sources with running sums of elapsed seconds, so "time logged since
+// T" is a binary search, as in the record index.
+//
+// The same session can turn up more than once: machines that all started
+// from the old shared solanum.dat each have a copy of it, and a pomodoro run
+// on two machines at once stops at the same second on both. A record whose
+// timestamp and elapsed seconds match one already in the view, kept in an
+// open-addressing hash set, or one of this machine's records is dropped.
+//
+// Merging is incremental. What the sources gained since the last merge is
+// merged on its own and, since it is nearly always newer than the whole view,
+// appended; otherwise the two sorted runs are merged in one pass from the
+// back. Only when a source changed records that are already in the view or
+// went away, or this machine changed a record of its own, is the view merged
+// again from the sources in memory.
+//
+// The view is applied to the rollup tables as it changes, so reports and the
+// calendar count every machine. Like our own, other machines' named timer
+// records are not focus time and stay out of the view. Projects stay per
+// machine: tag ids only mean something with the machine's own
+// solanum-<machine>.tags.
+
+#pragma once
+
+#define MERGE_NAME_SIZE 64
+#define MERGE_EMPTY_KEY UINT64_MAX
+#define MERGE_PREFETCH_DISTANCE 16
+
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#define MERGE_PREFETCH(address) _mm_prefetch((const char*)(address), _MM_HINT_T0)
+#else
+#define MERGE_PREFETCH(address) __builtin_prefetch(address)
+#endif
+
+struct MergeSource {
+    char name[MERGE_NAME_SIZE];  // The machine, from its file names.
+    TimeRecord* records;
+    uint16* tags;                // The machine's own tag ids. Only TAG_TIMER means anything here.
+    int64 num_records;
+    int64 capacity;
+    int64 num_merged;            // records[0, num_merged) went into the view.
+    bool32 rewritten;            // Records below num_merged changed.
+    bool32 present;              // Its files were there on the last look.
+
+    // How far the platform got reading the machine's files.
+    int64 data_size;
+    int64 data_mtime;
+    int64 journal_bytes;
+};
+
+struct MergeKeySet {
+    uint64* slots;     // MERGE_EMPTY_KEY where free.
+    int64 num_slots;   // A power of two, at least twice count.
+    int shift;         // 64 - log2(num_slots).
+    int64 count;
+};
+
+struct HistoryMerge {
+    MergeSource* sources;
+    int num_sources;
+    int sources_capacity;
+
+    TimeRecord* records;  // The view, sorted by timestamp.
+    int64* cumulative;    // cumulative[i] is the elapsed sum of records 0..i.
+    int64 num_records;
+    int64 capacity;
+
+    MergeKeySet keys;     // Of every record in the view.
+    bool32 stale;         // Our own records changed in a way the view may not reflect.
+    uint32 version;       // Bumped when the view changes.
+};
+
+// Timestamps fit in 47 bits for the next four million years, so the key is
+// exact: two records have the same key only if they are the same session.
+static uint64
+merge_key(TimeRecord record) {
+    return ((uint64)record.timestamp << 16) | (uint16)record.elapsed;
+}
+
+// Slot the search for key starts at: the top bits of a Fibonacci hash.
+static int64
+merge_key_home(MergeKeySet* set, uint64 key) {
+    return (int64)((key * 0x9e3779b97f4a7c15ull) >> set->shift);
+}
+
+static int64
+merge_key_slot(MergeKeySet* set, uint64 key) {
+    uint64 mask = (uint64)set->num_slots - 1;
+    uint64 slot = (uint64)merge_key_home(set, key);
+    while (set->slots[slot] != MERGE_EMPTY_KEY && set->slots[slot] != key) {
+        slot = (slot + 1) & mask;
+    }
+    return (int64)slot;
+}
+
+static void
+merge_key_set_free(MergeKeySet* set) {
+    free(set->slots);
+    *set = {};
+}
+
+// Makes room for count keys in all, so adding them never rehashes.
+static bool32
+merge_key_set_reserve(MergeKeySet* set, int64 count) {
+    if (2 * count <= set->num_slots) {
+        return true;
+    }
+    int64 num_slots = set->num_slots ? set->num_slots : 1024;
+    while (num_slots < 2 * count) {
+        num_slots *= 2;
+    }
+    uint64* slots = (uint64*)malloc((size_t)num_slots * sizeof(uint64));
+    if (!slots) {
+        return false;
+    }
+    memset(slots, 0xff, (size_t)num_slots * sizeof(uint64));
+    MergeKeySet old = *set;
+    set->slots = slots;
+    set->num_slots = num_slots;
+    set->shift = 64;
+    for (int64 n = num_slots; n > 1; n /= 2) {
+        --set->shift;
+    }
+    for (int64 i = 0; i < old.num_slots; ++i) {
+        if (old.slots[i] != MERGE_EMPTY_KEY) {
+            set->slots[merge_key_slot(set, old.slots[i])] = old.slots[i];
+        }
+    }
+    free(old.slots);
+    return true;
+}
+
+static bool32
+merge_key_set_has(MergeKeySet* set, uint64 key) {
+    return set->count && set->slots[merge_key_slot(set, key)] == key;
+}
+
+// Keeps the records of records[0, count) whose keys are not in the set yet
+// and adds those keys, which the set must have room for. Returns how many
+// were kept.
+//
+// Keys land all over a table far bigger than the caches, so every lookup is
+// a miss to memory. We ask for the slot of the record MERGE_PREFETCH_DISTANCE
+// ahead while we look at this one, which keeps that many misses in flight.
+static int64
+merge_key_set_add_new(MergeKeySet* set, TimeRecord* records, int64 count) {
+    int64 kept = 0;
+    for (int64 i = 0; i < count; ++i) {
+        if (i + MERGE_PREFETCH_DISTANCE < count) {
+            MERGE_PREFETCH(&set->slots[merge_key_home(set, merge_key(records[i + MERGE_PREFETCH_DISTANCE]))]);
+        }
+        uint64 key = merge_key(records[i]);
+        int64 slot = merge_key_slot(set, key);
+        if (set->slots[slot] != key) {
+            set->slots[slot] = key;
+            ++set->count;
+            records[kept++] = records[i];
+        }
+    }
+    return kept;
+}
+
+static bool32
+merge_source_reserve(MergeSource* source, int64 count) {
+    if (count <= source->capacity) {
+        return true;
+    }
+    int64 capacity = source->capacity ? source->capacity : 1024;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    TimeRecord* records = (TimeRecord*)realloc(source->records, (size_t)capacity * sizeof(TimeRecord));
+    if (records) {
+        source->records = records;
+    }
+    uint16* tags = (uint16*)realloc(source->tags, (size_t)capacity * sizeof(uint16));
+    if (tags) {
+        source->tags = tags;
+    }
+    if (!records || !tags) {
+        return false;
+    }
+    source->capacity = capacity;
+    return true;
+}
+
+static void
+merge_source_free(MergeSource* source) {
+    free(source->records);
+    free(source->tags);
+    *source = {};
+}
+
+// The source for machine `name`, added if it is new. NULL when out of memory.
+static MergeSource*
+history_merge_source(HistoryMerge* merge, const char* name) {
+    for (int i = 0; i < merge->num_sources; ++i) {
+        if (!strcmp(merge->sources[i].name, name)) {
+            return &merge->sources[i];
+        }
+    }
+    if (merge->num_sources == merge->sources_capacity) {
+        int capacity = merge->sources_capacity ? merge->sources_capacity * 2 : 8;
+        MergeSource* sources = (MergeSource*)realloc(merge->sources, (size_t)capacity * sizeof(MergeSource));
+        if (!sources) {
+            return NULL;
+        }
+        merge->sources = sources;
+        merge->sources_capacity = capacity;
+    }
+    MergeSource* source = &merge->sources[merge->num_sources++];
+    *source = {};
+    snprintf(source->name, MERGE_NAME_SIZE, "%s", name);
+    return source;
+}
+
+static void
+history_merge_free(HistoryMerge* merge) {
+    for (int i = 0; i < merge->num_sources; ++i) {
+        merge_source_free(&merge->sources[i]);
+    }
+    free(merge->sources);
+    free(merge->records);
+    free(merge->cumulative);
+    merge_key_set_free(&merge->keys);
+    *merge = {};
+}
+
+static bool32
+history_merge_reserve(HistoryMerge* merge, int64 count) {
+    if (count <= merge->capacity) {
+        return true;
+    }
+    int64 capacity = merge->capacity ? merge->capacity : 1024;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    TimeRecord* records = (TimeRecord*)realloc(merge->records, (size_t)capacity * sizeof(TimeRecord));
+    if (records) {
+        merge->records = records;
+    }
+    int64* cumulative = (int64*)realloc(merge->cumulative, (size_t)capacity * sizeof(int64));
+    if (cumulative) {
+        merge->cumulative = cumulative;
+    }
+    if (!records || !cumulative) {
+        return false;
+    }
+    merge->capacity = capacity;
+    return true;
+}
+
+// Adds the view's records from..to to the rollup tables, or takes them out
+// again with sign -1.
+static void
+history_merge_apply(HistoryMerge* merge, RollupTable* rollups, int64 from, int64 to, int sign) {
+    for (int64 i = from; i < to; ++i) {
+        rollup_table_apply(rollups, merge->records[i], sign);
+    }
+}
+
+// Empties the view, so the next update merges every source from the start.
+static void
+history_merge_reset(HistoryMerge* merge, RollupTable* rollups) {
+    history_merge_apply(merge, rollups, 0, merge->num_records, -1);
+    merge->num_records = 0;
+    merge_key_set_free(&merge->keys);
+    merge->stale = false;
+    for (int i = 0; i < merge->num_sources; ++i) {
+        merge->sources[i].num_merged = 0;
+        merge->sources[i].rewritten = false;
+    }
+    ++merge->version;
+}
+
+// Whether this machine has the session. pos is a cursor into the local index,
+// -1 to start with a binary search, that follows the timestamps asked about,
+// so asking in time order walks the index once.
+static bool32
+merge_local_has(RecordIndex* index, TimeRecord* local, TimeRecord record, int64* pos) {
+    int64 i = *pos;
+    if (i < 0 || (i > 0 && index->timestamps[i - 1] >= record.timestamp)) {
+        i = record_index_search(index, record.timestamp, false);
+    }
+    while (i < index->count && index->timestamps[i] < record.timestamp) {
+        ++i;
+    }
+    *pos = i;
+    for (; i < index->count && index->timestamps[i] == record.timestamp; ++i) {
+        if (local[index->record_ids[i]].elapsed == record.elapsed) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int
+merge_compare_records(const void* a, const void* b) {
+    int64 ta = ((const TimeRecord*)a)->timestamp;
+    int64 tb = ((const TimeRecord*)b)->timestamp;
+    return ta < tb ? -1 : ta > tb;
+}
+
+// Timestamp of the next record of source number s in a k-way merge.
+#define MERGE_HEAD(s) (merge->sources[s].records[cursors[s]].timestamp)
+
+// Sifts heap[at] down a min-heap of source numbers ordered by MERGE_HEAD.
+static void
+merge_heap_down(HistoryMerge* merge, int* heap, int size, int64* cursors, int at) {
+    for (;;) {
+        int least = at;
+        int left = 2 * at + 1;
+        int right = left + 1;
+        if (left < size && MERGE_HEAD(heap[left]) < MERGE_HEAD(heap[least])) {
+            least = left;
+        }
+        if (right < size && MERGE_HEAD(heap[right]) < MERGE_HEAD(heap[least])) {
+            least = right;
+        }
+        if (least == at) {
+            return;
+        }
+        int swap = heap[at];
+        heap[at] = heap[least];
+        heap[least] = swap;
+        at = least;
+    }
+}
+
+// Merges what the sources gained since the last call into the view and the
+// rollup tables. local are this machine's records, local_tags their tags and
+// index their record index. Returns true if the view changed. When out of memory the view is
+// left empty, to be merged in full on the next call.
+static bool32
+history_merge_update(HistoryMerge* merge, RecordIndex* index, TimeRecord* local, const uint16* local_tags,
+                     int64 num_local, RollupTable* rollups) {
+    bool32 changed = false;
+    bool32 full = merge->stale;
+    for (int i = 0; i < merge->num_sources; ++i) {
+        full = full || merge->sources[i].rewritten || !merge->sources[i].present;
+    }
+    if (full) {
+        history_merge_reset(merge, rollups);
+        int kept = 0;
+        for (int i = 0; i < merge->num_sources; ++i) {
+            if (merge->sources[i].present) {
+                merge->sources[kept++] = merge->sources[i];
+            }
+            else {
+                merge_source_free(&merge->sources[i]);
+            }
+        }
+        merge->num_sources = kept;
+        changed = true;
+    }
+
+    int64 num_fresh = 0;
+    for (int i = 0; i < merge->num_sources; ++i) {
+        num_fresh += merge->sources[i].num_records - merge->sources[i].num_merged;
+    }
+    if (!num_fresh) {
+        return changed;
+    }
+    if (!index->built && !record_index_build(index, local, local_tags, num_local)) {
+        history_merge_reset(merge, rollups);
+        return true;
+    }
+    TimeRecord* fresh = (TimeRecord*)malloc((size_t)num_fresh * sizeof(TimeRecord));
+    int64* cursors = (int64*)malloc((size_t)merge->num_sources * sizeof(int64));
+    int* heap = (int*)malloc((size_t)merge->num_sources * sizeof(int));
+    bool32 ok = fresh && cursors && heap;
+
+    // K-way merge of the new records, dropping named timers' and the ones
+    // this machine has, then the ones already in the view or twice in what
+    // is new.
+    int64 count = 0;
+    int heap_size = 0;
+    for (int s = 0; ok && s < merge->num_sources; ++s) {
+        cursors[s] = merge->sources[s].num_merged;
+        if (cursors[s] < merge->sources[s].num_records) {
+            heap[heap_size++] = s;
+        }
+    }
+    for (int at = heap_size / 2 - 1; ok && at >= 0; --at) {
+        merge_heap_down(merge, heap, heap_size, cursors, at);
+    }
+    int64 local_pos = -1;
+    while (ok && heap_size) {
+        int s = heap[0];
+        int64 id = cursors[s]++;
+        TimeRecord record = merge->sources[s].records[id];
+        if (cursors[s] == merge->sources[s].num_records) {
+            heap[0] = heap[--heap_size];
+        }
+        merge_heap_down(merge, heap, heap_size, cursors, 0);
+        if (record_is_focus(merge->sources[s].tags, id) && !merge_local_has(index, local, record, &local_pos)) {
+            fresh[count++] = record;
+        }
+    }
+    ok = ok && merge_key_set_reserve(&merge->keys, merge->keys.count + count);
+    if (ok) {
+        count = merge_key_set_add_new(&merge->keys, fresh, count);
+    }
+    ok = ok && history_merge_reserve(merge, merge->num_records + count);
+    if (!ok) {
+        free(fresh);
+        free(cursors);
+        free(heap);
+        history_merge_reset(merge, rollups);
+        return true;
+    }
+    for (int s = 0; s < merge->num_sources; ++s) {
+        merge->sources[s].num_merged = merge->sources[s].num_records;
+    }
+
+    // A source edited back in time hands us records out of order.
+    for (int64 i = 1; i < count; ++i) {
+        if (fresh[i].timestamp < fresh[i - 1].timestamp) {
+            qsort(fresh, (size_t)count, sizeof(TimeRecord), merge_compare_records);
+            break;
+        }
+    }
+
+    // Into the view: appended when newer than all of it, which is nearly
+    // always, or merged from the back otherwise.
+    TimeRecord* view = merge->records;
+    int64 old_count = merge->num_records;
+    int64 first_changed = old_count;
+    if (count && old_count && fresh[0].timestamp < view[old_count - 1].timestamp) {
+        int64 i = old_count - 1;
+        int64 j = count - 1;
+        for (int64 k = old_count + count - 1; j >= 0; --k) {
+            if (i >= 0 && view[i].timestamp > fresh[j].timestamp) {
+                view[k] = view[i--];
+            }
+            else {
+                view[k] = fresh[j--];
+            }
+        }
+        first_changed = i + 1;
+    }
+    else if (count) {
+        memcpy(view + old_count, fresh, (size_t)count * sizeof(TimeRecord));
+    }
+    merge->num_records = old_count + count;
+    int64 sum = first_changed > 0 ? merge->cumulative[first_changed - 1] : 0;
+    for (int64 i = first_changed; i < merge->num_records; ++i) {
+        sum += view[i].elapsed;
+        merge->cumulative[i] = sum;
+    }
+    for (int64 i = 0; i < count; ++i) {
+        rollup_table_apply(rollups, fresh[i], 1);
+    }
+    free(fresh);
+    free(cursors);
+    free(heap);
+    if (count) {
+        ++merge->version;
+    }
+    return changed || count > 0;
+}
+
+#undef MERGE_HEAD
+
+// Whether the view has the session.
+static bool32
+history_merge_has(HistoryMerge* merge, TimeRecord record) {
+    return merge_key_set_has(&merge->keys, merge_key(record));
+}
+
+// Sum of elapsed seconds of the view's records with timestamp >= t.
+static int64
+history_merge_seconds_since(HistoryMerge* merge, int64 t) {
+    int64 lo = 0;
+    int64 hi = merge->num_records;
+    while (lo < hi) {
+        int64 mid = lo + (hi - lo) / 2;
+        if (merge->records[mid].timestamp < t) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    if (lo == merge->num_records) {
+        return 0;
+    }
+    int64 before = lo > 0 ? merge->cumulative[lo - 1] : 0;
+    return merge->cumulative[merge->num_records - 1] - before;
+}
@@ -0,0 +1,55 @@
+// io_queue.h
+//
+// Journal entries on their way from the UI thread to the I/O thread.
+//
+// A single-producer, single-consumer ring. The UI thread only ever writes
+// `tail` and the I/O thread only ever writes `head`, so neither side takes a
+// lock or waits for the other. Entries stay in the ring until they are on
+// disk, which lets the I/O thread retry a failed write without any help.
+
+#pragma once
+
+#include <atomic>
+
+#define IO_QUEUE_SIZE 4096  // Must be a power of two.
+
+struct IoQueue {
+    JournalEntry entries[IO_QUEUE_SIZE];
+    std::atomic<uint64> head;  // First entry not yet on disk.
+    char padding[64];          // Keep head and tail on separate cache lines.
+    std::atomic<uint64> tail;  // One past the last entry queued.
+};
+
+// Producer side. Queues all of the entries or, if there isn't room, none.
+static bool32
+io_queue_push(IoQueue* queue, const JournalEntry* entries, int num_entries) {
+    uint64 tail = queue->tail.load(std::memory_order_relaxed);
+    uint64 head = queue->head.load(std::memory_order_acquire);
+    if (IO_QUEUE_SIZE - (tail - head) < (uint64)num_entries) {
+        return false;
+    }
+    for (int i = 0; i < num_entries; ++i) {
+        queue->entries[(tail + (uint64)i) & (IO_QUEUE_SIZE - 1)] = entries[i];
+    }
+    queue->tail.store(tail + (uint64)num_entries, std::memory_order_release);
+    return true;
+}
+
+// Consumer side. Copies out up to max_entries of the oldest entries without
+// removing them.
+static int
+io_queue_peek(IoQueue* queue, JournalEntry* out, int max_entries) {
+    uint64 head = queue->head.load(std::memory_order_relaxed);
+    uint64 tail = queue->tail.load(std::memory_order_acquire);
+    int num_entries = tail - head < (uint64)max_entries ? (int)(tail - head) : max_entries;
+    for (int i = 0; i < num_entries; ++i) {
+        out[i] = queue->entries[(head + (uint64)i) & (IO_QUEUE_SIZE - 1)];
+    }
+    return num_entries;
+}
+
+// Consumer side. Drops the oldest num_entries entries once they are written.
+static void
+io_queue_pop(IoQueue* queue, int num_entries) {
+    queue->head.fetch_add((uint64)num_entries, std::memory_order_release);
+}
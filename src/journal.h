@@ -0,0 +1,135 @@
+// journal.h
+//
+// solanum.dat is a snapshot of the records (see snapshot.h). Every change
+// after the snapshot goes to solanum.jnl as a fixed-size framed
+// JournalEntry, so saving a finished pomodoro costs one small append no matter
+// how long the history is. Compaction folds the journal back into the snapshot.
+//
+// solanum.jnl layout:
+//   JournalHeader
+//   JournalEntry, JournalEntry, ...
+//
+// A torn write can only damage the last entry. Replay stops at the first entry
+// that is short or fails its checksum.
+
+#pragma once
+
+#define JOURNAL_MAGIC 0x4c4e4a53  // "SJNL"
+#define JOURNAL_VERSION 2  // v1 had no RecordOp_TAG.
+
+// Number of journal entries after which we fold the journal into the snapshot.
+#define JOURNAL_COMPACT_THRESHOLD 4096
+
+struct JournalHeader {
+    uint32 magic;
+    uint32 version;
+};
+
+// A v1 journal reads the same, it just never tags anything. Its header is
+// rewritten before anything is appended, so a v1 build won't replay our tags.
+static bool32
+journal_header_valid(const JournalHeader* header) {
+    return header->magic == JOURNAL_MAGIC && header->version >= 1 && header->version <= JOURNAL_VERSION;
+}
+
+// FNV-1a over everything but the checksum field.
+static uint32
+journal_checksum(const JournalEntry* entry) {
+    const uint8* bytes = (const uint8*)entry;
+    size_t size = offsetof(JournalEntry, checksum);
+    uint32 hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// tags is the tag column for records and has room for records_size tags too.
+static bool32
+journal_apply(TimeRecord* records, uint16* tags, size_t records_size, int64* num_records,
+              const JournalEntry* entry) {
+    switch (entry->op) {
+        case RecordOp_APPEND: {
+            if (entry->index < 0 || entry->index > *num_records || (size_t)entry->index >= records_size) {
+                return false;
+            }
+            records[entry->index] = entry->record;
+            tags[entry->index] = TAG_NONE;
+            *num_records = entry->index + 1;
+        } break;
+        case RecordOp_EDIT: {
+            if (entry->index < 0 || entry->index >= *num_records) {
+                return false;
+            }
+            records[entry->index] = entry->record;
+        } break;
+        case RecordOp_TRUNCATE: {
+            if (entry->index < 0 || entry->index > *num_records) {
+                return false;
+            }
+            *num_records = entry->index;
+        } break;
+        case RecordOp_TAG: {
+            if (entry->index < 0 || entry->index >= *num_records) {
+                return false;
+            }
+            tags[entry->index] = entry->tag;
+        } break;
+        default: {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Applies up to max_bytes of the journal in fd. Returns the length in bytes of
+// the valid prefix, 0 when the file has no usable header, or -1 when an intact
+// entry can't be applied because it doesn't fit in records_size or doesn't
+// match the snapshot.
+//
+// A snapshot that lost its end (SnapshotStatus_TRUNCATED) is missing records
+// the journal builds on, so the first append past them can't be applied. With
+// stop_at_gap set, replay ends at that entry instead of failing, and what it
+// returns is the prefix that could be applied.
+static int64
+journal_replay(FILE* fd, int64 max_bytes,
+               TimeRecord* records, uint16* tags, size_t records_size, int64* num_records,
+               int64* out_num_entries, bool32 stop_at_gap) {
+    *out_num_entries = 0;
+    JournalHeader header = {};
+    if (fread(&header, sizeof(header), 1, fd) != 1 || !journal_header_valid(&header)) {
+        return 0;
+    }
+    int64 valid_bytes = sizeof(header);
+    JournalEntry entry;
+    while (valid_bytes + (int64)sizeof(entry) <= max_bytes &&
+           fread(&entry, sizeof(entry), 1, fd) == 1) {
+        if (entry.checksum != journal_checksum(&entry)) {
+            break;
+        }
+        if (!journal_apply(records, tags, records_size, num_records, &entry)) {
+            if (stop_at_gap) {
+                break;
+            }
+            return -1;
+        }
+        valid_bytes += sizeof(entry);
+        ++*out_num_entries;
+    }
+    return valid_bytes;
+}
+
+static bool32
+journal_write_header(FILE* fd) {
+    JournalHeader header = { JOURNAL_MAGIC, JOURNAL_VERSION };
+    return fwrite(&header, sizeof(header), 1, fd) == 1;
+}
+
+static bool32
+journal_write_entries(FILE* fd, JournalEntry* entries, int num_entries) {
+    for (int i = 0; i < num_entries; ++i) {
+        entries[i].checksum = journal_checksum(&entries[i]);
+    }
+    return fwrite(entries, sizeof(JournalEntry), (size_t)num_entries, fd) == (size_t)num_entries;
+}
@@ -0,0 +1,226 @@
+// peers.h
+//
+// Reads the other machines' files in the data directory into the sources of a
+// HistoryMerge (see history_merge.h). A machine's files are
+// solanum-<machine>.dat and solanum-<machine>.jnl; they are only ever read
+// here, never written.
+//
+// A machine is read in full the first time we see it and whenever its
+// snapshot changed, which is what its journal compaction looks like. Otherwise
+// only the journal entries past the ones we read last time are applied, so a
+// machine that logged one more pomodoro costs two stats and a small read.
+//
+// The files may be half synced when we look. A snapshot that doesn't verify or
+// a journal that doesn't fit it leaves the source as it was, and we try again
+// on the next scan.
+
+#pragma once
+
+#define PEER_FILE_PREFIX "solanum-"
+
+struct PeerScan {
+    HistoryMerge* merge;
+    const char* self;
+};
+
+// The machine a file in the data directory belongs to, if it is one of
+// solanum-<machine>.dat or solanum-<machine>.jnl. machine has room for
+// MERGE_NAME_SIZE characters.
+static bool32
+peers_machine_of(const char* name, char* machine) {
+    size_t prefix_len = strlen(PEER_FILE_PREFIX);
+    size_t len = strlen(name);
+    if (len <= prefix_len + 4 || strncmp(name, PEER_FILE_PREFIX, prefix_len) != 0 ||
+        (strcmp(name + len - 4, ".dat") != 0 && strcmp(name + len - 4, ".jnl") != 0)) {
+        return false;
+    }
+    size_t machine_len = len - prefix_len - 4;
+    if (machine_len >= MERGE_NAME_SIZE) {
+        return false;
+    }
+    memcpy(machine, name + prefix_len, machine_len);
+    machine[machine_len] = '\0';
+    return true;
+}
+
+// Marks the source of every solanum-<machine>.dat or .jnl but our own present.
+static void
+peers_on_file(const char* name, void* user) {
+    PeerScan* scan = (PeerScan*)user;
+    char machine[MERGE_NAME_SIZE];
+    if (!peers_machine_of(name, machine) || !strcmp(machine, scan->self)) {
+        return;
+    }
+    MergeSource* source = history_merge_source(scan->merge, machine);
+    if (source) {
+        source->present = true;
+    }
+}
+
+// Applies the journal entries from source->journal_bytes up to journal_size.
+// Returns false if one doesn't fit the records we have.
+static bool32
+peers_read_journal(MergeSource* source, const char* journal_path, int64 journal_size) {
+    FILE* fd = fopen(journal_path, "rb");
+    if (!fd) {
+        return true;
+    }
+    if (source->journal_bytes < (int64)sizeof(JournalHeader)) {
+        JournalHeader header = {};
+        if (fread(&header, sizeof(header), 1, fd) != 1 || !journal_header_valid(&header)) {
+            fclose(fd);
+            return true;
+        }
+        source->journal_bytes = sizeof(header);
+    }
+    fseek(fd, (long)source->journal_bytes, SEEK_SET);
+    bool32 ok = true;
+    JournalEntry entry;
+    while (ok && source->journal_bytes + (int64)sizeof(entry) <= journal_size &&
+           fread(&entry, sizeof(entry), 1, fd) == 1) {
+        if (entry.checksum != journal_checksum(&entry)) {
+            break;
+        }
+        // Entries for records already in the view mean merging again, unless
+        // they write what is there, as entries replayed after compaction do.
+        // Tags only matter where they decide whether a record is in the view.
+        bool32 touches_merged = entry.index >= 0 && entry.index < source->num_merged;
+        if (touches_merged && entry.op == RecordOp_TAG) {
+            touches_merged = (entry.tag == TAG_TIMER) != (source->tags[entry.index] == TAG_TIMER);
+        }
+        else if (touches_merged && entry.op != RecordOp_TRUNCATE &&
+                 !memcmp(&source->records[entry.index], &entry.record, sizeof(TimeRecord))) {
+            touches_merged = false;
+        }
+        if (entry.op == RecordOp_APPEND && entry.index >= 0) {
+            ok = merge_source_reserve(source, entry.index + 1);
+        }
+        ok = ok && journal_apply(source->records, source->tags, (size_t)source->capacity,
+                                 &source->num_records, &entry);
+        if (ok) {
+            source->journal_bytes += sizeof(entry);
+            source->rewritten = source->rewritten || touches_merged;
+        }
+    }
+    fclose(fd);
+    return ok;
+}
+
+// Reads a machine's snapshot and journal from the start. Records that went
+// into the view before only count as rewritten if they are not a prefix of
+// what we read now.
+static bool32
+peers_read_full(MergeSource* source, const char* data_path, const char* journal_path, int64 journal_size) {
+    MergeSource read = {};
+    SnapshotInfo info = {};
+    FILE* fd = fopen(data_path, "rb");
+    if (fd) {
+        snapshot_read_info(fd, &info);
+    }
+    bool32 ok = info.status != SnapshotStatus_CORRUPT && merge_source_reserve(&read, info.num_valid + 1);
+    if (ok && fd) {
+        snapshot_read_records(fd, &info, read.records, read.tags);
+        read.num_records = info.num_valid;
+        ok = info.status != SnapshotStatus_CORRUPT;
+    }
+    if (fd) {
+        fclose(fd);
+    }
+    ok = ok && peers_read_journal(&read, journal_path, journal_size);
+    if (!ok) {
+        merge_source_free(&read);
+        return false;
+    }
+    int64 merged = source->num_merged;
+    read.rewritten = source->rewritten || merged > read.num_records ||
+            (merged && memcmp(read.records, source->records, (size_t)merged * sizeof(TimeRecord)) != 0);
+    read.num_merged = merged;
+    read.present = source->present;
+    memcpy(read.name, source->name, MERGE_NAME_SIZE);
+    merge_source_free(source);
+    *source = read;
+    return true;
+}
+
+// Finds the machines with files in dir, other than self, and brings their
+// sources up to date. Sources whose files are gone are left not present, for
+// history_merge_update to drop.
+static void
+peers_scan(HistoryMerge* merge, const char* dir, const char* self) {
+    for (int i = 0; i < merge->num_sources; ++i) {
+        merge->sources[i].present = false;
+    }
+    PeerScan scan = { merge, self };
+    list_directory(dir, peers_on_file, &scan);
+
+    for (int i = 0; i < merge->num_sources; ++i) {
+        MergeSource* source = &merge->sources[i];
+        if (!source->present) {
+            continue;
+        }
+        char data_path[MAX_PATH];
+        char journal_path[MAX_PATH];
+        snprintf(data_path, MAX_PATH, "%s" PEER_FILE_PREFIX "%s.dat", dir, source->name);
+        snprintf(journal_path, MAX_PATH, "%s" PEER_FILE_PREFIX "%s.jnl", dir, source->name);
+        struct stat st;
+        int64 data_size = -1;
+        int64 data_mtime = 0;
+        if (stat(data_path, &st) == 0) {
+            data_size = (int64)st.st_size;
+            data_mtime = (int64)st.st_mtime;
+        }
+        int64 journal_size = stat(journal_path, &st) == 0 ? (int64)st.st_size : 0;
+
+        bool32 full = data_size != source->data_size || data_mtime != source->data_mtime ||
+                journal_size < source->journal_bytes;
+        if (!full && journal_size > source->journal_bytes &&
+            !peers_read_journal(source, journal_path, journal_size)) {
+            full = true;
+        }
+        if (full) {
+            bool32 ok = peers_read_full(source, data_path, journal_path, journal_size);
+            // Sizes are never below -1, so a failed read is tried again.
+            source->data_size = ok ? data_size : -2;
+            source->data_mtime = data_mtime;
+        }
+    }
+}
+
+struct PeerSignature {
+    const char* dir;
+    const char* self;
+    uint64 hash;
+};
+
+static void
+peers_sign_file(const char* name, void* user) {
+    PeerSignature* signature = (PeerSignature*)user;
+    char machine[MERGE_NAME_SIZE];
+    if (!peers_machine_of(name, machine) || !strcmp(machine, signature->self)) {
+        return;
+    }
+    char path[MAX_PATH];
+    snprintf(path, MAX_PATH, "%s%s", signature->dir, name);
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return;
+    }
+    uint64 hash = 14695981039346656037ull;
+    for (const char* c = name; *c; ++c) {
+        hash = (hash ^ (uint8)*c) * 1099511628211ull;
+    }
+    hash = (hash ^ (uint64)st.st_size) * 1099511628211ull;
+    hash = (hash ^ (uint64)st.st_mtime) * 1099511628211ull;
+    // Summed, so the order files are listed in doesn't matter.
+    signature->hash += hash;
+}
+
+// Changes whenever one of the other machines' files in dir appears, goes away,
+// or changes size or modification time. For watching by polling, where a
+// scan that reads nothing new is still worth avoiding.
+static uint64
+peers_signature(const char* dir, const char* self) {
+    PeerSignature signature = { dir, self, 0 };
+    list_directory(dir, peers_sign_file, &signature);
+    return signature.hash;
+}
@@ -0,0 +1,177 @@
+// profiler.h
+//
+// Where a frame's time goes. PROFILE_SCOPE(stage) times the rest of the
+// enclosing block and adds it to the current frame's entry for that stage,
+// in a ring of the last PROFILER_NUM_FRAMES frames. F3 shows the ring as
+// plots with min, average and 99th percentile per stage.
+//
+// While the overlay is off each scope costs one test of a global. Building
+// with SOLANUM_PROFILER=0 removes all of it.
+
+#pragma once
+
+#ifndef SOLANUM_PROFILER
+#define SOLANUM_PROFILER 1
+#endif
+
+enum ProfileStage {
+    ProfileStage_NEW_FRAME,
+    ProfileStage_STEP,        // timer_step_and_render
+    ProfileStage_RENDER,      // ImGui::Render, without the draw lists
+    ProfileStage_DRAW_LISTS,  // ImGui_ImplSDLGL3_RenderDrawLists
+    ProfileStage_SWAP,
+    ProfileStage_COUNT,
+};
+
+#if SOLANUM_PROFILER
+
+#define PROFILER_NUM_FRAMES 240
+
+struct Profiler {
+    bool32 enabled;
+    int frame;       // Ring slot of the frame being recorded.
+    int num_frames;  // Slots filled so far.
+    float ms[ProfileStage_COUNT][PROFILER_NUM_FRAMES];
+    double ms_per_tick;
+    void (*render_draw_lists)(ImDrawData* data);
+};
+
+static Profiler g_profiler;
+
+static const char* g_profile_stage_names[ProfileStage_COUNT] = {
+    "NewFrame",
+    "timer_step_and_render",
+    "ImGui::Render",
+    "RenderDrawLists",
+    "SwapWindow",
+};
+
+struct ProfileScope {
+    ProfileStage stage;
+    uint64 begin;
+
+    ProfileScope(ProfileStage stage) : stage(stage), begin(0) {
+        if (g_profiler.enabled) {
+            begin = SDL_GetPerformanceCounter();
+        }
+    }
+
+    ~ProfileScope() {
+        if (begin) {
+            float ms = (float)((double)(SDL_GetPerformanceCounter() - begin) * g_profiler.ms_per_tick);
+            g_profiler.ms[stage][g_profiler.frame] += ms;
+        }
+    }
+};
+
+#define PROFILE_SCOPE_NAME_(line) profile_scope_##line
+#define PROFILE_SCOPE_NAME(line) PROFILE_SCOPE_NAME_(line)
+#define PROFILE_SCOPE(stage) ProfileScope PROFILE_SCOPE_NAME(__LINE__)(stage)
+
+// ImGui::Render calls the draw lists function itself, so we time it by
+// wrapping the function pointer and take it back out of the Render stage.
+static void
+profiler_render_draw_lists(ImDrawData* data) {
+    uint64 begin = g_profiler.enabled ? SDL_GetPerformanceCounter() : 0;
+    g_profiler.render_draw_lists(data);
+    if (begin) {
+        float ms = (float)((double)(SDL_GetPerformanceCounter() - begin) * g_profiler.ms_per_tick);
+        g_profiler.ms[ProfileStage_DRAW_LISTS][g_profiler.frame] += ms;
+        g_profiler.ms[ProfileStage_RENDER][g_profiler.frame] -= ms;
+    }
+}
+
+// Call after the ImGui binding is set up.
+static void
+profiler_init() {
+    g_profiler.ms_per_tick = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    ImGuiIO& io = ImGui::GetIO();
+    g_profiler.render_draw_lists = io.RenderDrawListsFn;
+    io.RenderDrawListsFn = profiler_render_draw_lists;
+}
+
+static void
+profiler_toggle() {
+    g_profiler.enabled = !g_profiler.enabled;
+    g_profiler.num_frames = 0;
+}
+
+static void
+profiler_begin_frame() {
+    if (!g_profiler.enabled) {
+        return;
+    }
+    if (g_profiler.num_frames) {
+        g_profiler.frame = (g_profiler.frame + 1) % PROFILER_NUM_FRAMES;
+    }
+    if (g_profiler.num_frames < PROFILER_NUM_FRAMES) {
+        ++g_profiler.num_frames;
+    }
+    for (int stage = 0; stage < ProfileStage_COUNT; ++stage) {
+        g_profiler.ms[stage][g_profiler.frame] = 0;
+    }
+}
+
+static int
+profiler_compare_floats(const void* a, const void* b) {
+    float x = *(const float*)a;
+    float y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+// Draws the overlay. Call between timer_step_and_render and ImGui::Render.
+static void
+profiler_draw_overlay() {
+    if (!g_profiler.enabled || !g_profiler.num_frames) {
+        return;
+    }
+    int count = g_profiler.num_frames;
+    // The ring starts at its oldest frame once it has wrapped.
+    int offset = count == PROFILER_NUM_FRAMES ? (g_profiler.frame + 1) % PROFILER_NUM_FRAMES : 0;
+
+    ImGui::SetNextWindowPos({420, 200}, ImGuiSetCond_FirstUseEver);
+    ImGui::Begin("Profiler", NULL, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoSavedSettings);
+    ImGui::Text("Last %d frames, in ms. F3 to close.", count);
+
+    float totals[PROFILER_NUM_FRAMES] = {};
+    float sorted[PROFILER_NUM_FRAMES];
+    char overlay[128];
+    for (int stage = 0; stage <= ProfileStage_COUNT; ++stage) {
+        const float* values = totals;
+        const char* name = "Frame";
+        if (stage < ProfileStage_COUNT) {
+            values = g_profiler.ms[stage];
+            name = g_profile_stage_names[stage];
+            for (int i = 0; i < count; ++i) {
+                totals[i] += values[i];
+            }
+        }
+        memcpy(sorted, values, (size_t)count * sizeof(float));
+        qsort(sorted, (size_t)count, sizeof(float), profiler_compare_floats);
+        float sum = 0;
+        for (int i = 0; i < count; ++i) {
+            sum += sorted[i];
+        }
+        snprintf(overlay, sizeof(overlay), "min %.3f  avg %.3f  p99 %.3f",
+                 sorted[0], sum / count, sorted[(count - 1) * 99 / 100]);
+        if (stage < ProfileStage_COUNT) {
+            ImGui::PlotLines(name, values, count, offset, overlay, 0.0f, FLT_MAX, {320, 40});
+        }
+        else {
+            ImGui::Separator();
+            ImGui::PlotHistogram(name, values, count, offset, overlay, 0.0f, FLT_MAX, {320, 60});
+        }
+    }
+    ImGui::End();
+}
+
+#else
+
+#define PROFILE_SCOPE(stage)
+
+static void profiler_init() {}
+static void profiler_toggle() {}
+static void profiler_begin_frame() {}
+static void profiler_draw_overlay() {}
+
+#endif  // SOLANUM_PROFILER
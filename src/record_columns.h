@@ -0,0 +1,326 @@
+// record_columns.h
+//
+// The records as columns: the timestamps in one 64-byte aligned int64 array
+// and the elapsed seconds in an int32 one. TimeRecord is packed to ten bytes,
+// so a loop over TimerState::records does misaligned loads and doesn't
+// vectorize. The one scan over them, "seconds and records per bucket", builds
+// the rollup tables and takes four records per AVX2 instruction. Time logged
+// in an arbitrary range is a binary search in the record index instead.
+//
+// The kernel has an AVX2, an SSE4.2 and a plain version, picked at startup
+// from what the CPU has. SSE4.2 rather than 4.1 because that is where the
+// 64-bit compare came in.
+//
+// Like the record index, the columns are built on first use and patched as
+// records are appended, edited and deleted from then on. They stay parallel
+// to the records, so the ones that are not focus time are in there as a
+// timestamp of RECORD_COLUMNS_LEFT_OUT and zero seconds, which every range
+// and every bucket leaves out.
+
+#pragma once
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RECORD_COLUMNS_HAS_SIMD_PATH 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define RECORD_COLUMNS_TARGET_SSE42
+#define RECORD_COLUMNS_TARGET_AVX2
+#else
+#define RECORD_COLUMNS_TARGET_SSE42 __attribute__((target("sse4.2")))
+#define RECORD_COLUMNS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#define RECORD_COLUMNS_ALIGN 64
+#define RECORD_COLUMNS_LEFT_OUT INT64_MIN
+
+struct RecordColumns {
+    void* block;         // Both columns, from malloc.
+    int64* timestamps;   // Aligned to RECORD_COLUMNS_ALIGN.
+    int32* elapsed;      // Aligned to RECORD_COLUMNS_ALIGN.
+    int64 count;
+    int64 capacity;      // A multiple of 8, so elapsed stays aligned.
+    bool32 built;
+};
+
+// Adds the seconds and number of records of each bucket [starts[i],
+// starts[i + 1]) to seconds[i] and counts[i], for i below num_buckets.
+// Records outside all buckets are skipped. Fastest when records in the same
+// bucket are next to each other.
+typedef void RecordColumnsHistogramFn(int64* timestamps, int32* elapsed, int64 count,
+                                      int64* starts, int64 num_buckets, int64* seconds, int64* counts);
+
+static RecordColumnsHistogramFn* g_record_columns_histogram_fn;
+
+static void
+record_columns_free(RecordColumns* columns) {
+    free(columns->block);
+    *columns = {};
+}
+
+static bool32
+record_columns_reserve(RecordColumns* columns, int64 count) {
+    if (count <= columns->capacity) {
+        return true;
+    }
+    int64 capacity = columns->capacity ? columns->capacity : 1024;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    void* block = malloc((size_t)capacity * (sizeof(int64) + sizeof(int32)) + RECORD_COLUMNS_ALIGN);
+    if (!block) {
+        return false;
+    }
+    uintptr_t aligned = ((uintptr_t)block + RECORD_COLUMNS_ALIGN - 1) & ~(uintptr_t)(RECORD_COLUMNS_ALIGN - 1);
+    int64* timestamps = (int64*)aligned;
+    int32* elapsed = (int32*)(timestamps + capacity);
+    if (columns->count) {
+        memcpy(timestamps, columns->timestamps, (size_t)columns->count * sizeof(int64));
+        memcpy(elapsed, columns->elapsed, (size_t)columns->count * sizeof(int32));
+    }
+    free(columns->block);
+    columns->block = block;
+    columns->timestamps = timestamps;
+    columns->elapsed = elapsed;
+    columns->capacity = capacity;
+    return true;
+}
+
+static void
+record_columns_set(RecordColumns* columns, TimeRecord* records, const uint16* tags, int64 record_id) {
+    bool32 focus = record_is_focus(tags, record_id);
+    columns->timestamps[record_id] = focus ? records[record_id].timestamp : RECORD_COLUMNS_LEFT_OUT;
+    columns->elapsed[record_id] = focus ? records[record_id].elapsed : 0;
+}
+
+// tags, which may be NULL, picks the records that are focus time.
+static bool32
+record_columns_build(RecordColumns* columns, TimeRecord* records, const uint16* tags, int64 num_records) {
+    columns->count = 0;
+    if (!record_columns_reserve(columns, num_records)) {
+        record_columns_free(columns);
+        return false;
+    }
+    for (int64 i = 0; i < num_records; ++i) {
+        record_columns_set(columns, records, tags, i);
+    }
+    columns->count = num_records;
+    columns->built = true;
+    return true;
+}
+
+// Called after records[record_id] was appended and tagged.
+static void
+record_columns_on_append(RecordColumns* columns, TimeRecord* records, const uint16* tags, int64 record_id) {
+    if (!columns->built) {
+        return;
+    }
+    if (!record_columns_reserve(columns, record_id + 1)) {
+        record_columns_free(columns);
+        return;
+    }
+    record_columns_set(columns, records, tags, record_id);
+    columns->count = record_id + 1;
+}
+
+// Called after records[record_id] was changed in place.
+static void
+record_columns_on_edit(RecordColumns* columns, TimeRecord* records, const uint16* tags, int64 record_id) {
+    if (columns->built) {
+        record_columns_set(columns, records, tags, record_id);
+    }
+}
+
+// Called after the records from num_records on were dropped.
+static void
+record_columns_on_truncate(RecordColumns* columns, int64 num_records) {
+    if (columns->built && num_records < columns->count) {
+        columns->count = num_records;
+    }
+}
+
+// Index of the last of starts[0] to starts[count - 1] that is <= t.
+static int64
+record_columns_bucket(int64* starts, int64 count, int64 t) {
+    int64 lo = 0;
+    while (count > 1) {
+        int64 half = count / 2;
+        lo = starts[lo + half] <= t ? lo + half : lo;
+        count -= half;
+    }
+    return lo;
+}
+
+static void
+record_columns_histogram_c(int64* timestamps, int32* elapsed, int64 count,
+                           int64* starts, int64 num_buckets, int64* seconds, int64* counts) {
+    if (!num_buckets) {
+        return;
+    }
+    int64 bucket = 0;
+    for (int64 i = 0; i < count; ++i) {
+        int64 t = timestamps[i];
+        if (t < starts[bucket] || t >= starts[bucket + 1]) {
+            if (t < starts[0] || t >= starts[num_buckets]) {
+                continue;
+            }
+            bucket = record_columns_bucket(starts, num_buckets, t);
+        }
+        seconds[bucket] += elapsed[i];
+        ++counts[bucket];
+    }
+}
+
+#if RECORD_COLUMNS_HAS_SIMD_PATH
+// Like the plain version, but while a run of records stays in one bucket it
+// goes two records at a time, and only looks at each record on its own where
+// the bucket changes.
+RECORD_COLUMNS_TARGET_SSE42 static void
+record_columns_histogram_sse42(int64* timestamps, int32* elapsed, int64 count,
+                               int64* starts, int64 num_buckets, int64* seconds, int64* counts) {
+    if (!num_buckets) {
+        return;
+    }
+    int64 bucket = 0;
+    int64 i = 0;
+    while (i < count) {
+        int64 t = timestamps[i];
+        if (t < starts[bucket] || t >= starts[bucket + 1]) {
+            if (t < starts[0] || t >= starts[num_buckets]) {
+                ++i;
+                continue;
+            }
+            bucket = record_columns_bucket(starts, num_buckets, t);
+        }
+        // Odd positions one at a time, to keep the loads aligned.
+        if (i & 1) {
+            seconds[bucket] += elapsed[i];
+            ++counts[bucket];
+            ++i;
+            continue;
+        }
+        __m128i begin_v = _mm_set1_epi64x(starts[bucket]);
+        __m128i end_v = _mm_set1_epi64x(starts[bucket + 1]);
+        __m128i sum = _mm_setzero_si128();
+        int64 run = i;
+        for (; i + 2 <= count; i += 2) {
+            __m128i t2 = _mm_load_si128((__m128i*)(timestamps + i));
+            __m128i in = _mm_andnot_si128(_mm_cmpgt_epi64(begin_v, t2), _mm_cmpgt_epi64(end_v, t2));
+            if (_mm_movemask_epi8(in) != 0xffff) {
+                break;
+            }
+            sum = _mm_add_epi64(sum, _mm_cvtepi32_epi64(_mm_loadl_epi64((__m128i*)(elapsed + i))));
+        }
+        int64 lanes[2];
+        _mm_storeu_si128((__m128i*)lanes, sum);
+        seconds[bucket] += lanes[0] + lanes[1];
+        counts[bucket] += i - run;
+        if (i < count && timestamps[i] >= starts[bucket] && timestamps[i] < starts[bucket + 1]) {
+            seconds[bucket] += elapsed[i];
+            ++counts[bucket];
+            ++i;
+        }
+    }
+}
+
+RECORD_COLUMNS_TARGET_AVX2 static void
+record_columns_histogram_avx2(int64* timestamps, int32* elapsed, int64 count,
+                              int64* starts, int64 num_buckets, int64* seconds, int64* counts) {
+    if (!num_buckets) {
+        return;
+    }
+    int64 bucket = 0;
+    int64 i = 0;
+    while (i < count) {
+        int64 t = timestamps[i];
+        if (t < starts[bucket] || t >= starts[bucket + 1]) {
+            if (t < starts[0] || t >= starts[num_buckets]) {
+                ++i;
+                continue;
+            }
+            bucket = record_columns_bucket(starts, num_buckets, t);
+        }
+        if (i & 3) {
+            seconds[bucket] += elapsed[i];
+            ++counts[bucket];
+            ++i;
+            continue;
+        }
+        __m256i begin_v = _mm256_set1_epi64x(starts[bucket]);
+        __m256i end_v = _mm256_set1_epi64x(starts[bucket + 1]);
+        __m256i sum = _mm256_setzero_si256();
+        int64 run = i;
+        for (; i + 4 <= count; i += 4) {
+            __m256i t4 = _mm256_load_si256((__m256i*)(timestamps + i));
+            __m256i in = _mm256_andnot_si256(_mm256_cmpgt_epi64(begin_v, t4), _mm256_cmpgt_epi64(end_v, t4));
+            if (_mm256_movemask_epi8(in) != -1) {
+                break;
+            }
+            sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm_load_si128((__m128i*)(elapsed + i))));
+        }
+        int64 lanes[4];
+        _mm256_storeu_si256((__m256i*)lanes, sum);
+        seconds[bucket] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        counts[bucket] += i - run;
+        if (i < count && timestamps[i] >= starts[bucket] && timestamps[i] < starts[bucket + 1]) {
+            seconds[bucket] += elapsed[i];
+            ++counts[bucket];
+            ++i;
+        }
+    }
+}
+
+static bool32
+record_columns_cpu_has_sse42() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static bool32
+record_columns_cpu_has_avx2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    // The OS has to save the YMM registers too.
+    bool32 avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return avx && (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+// Picks the kernels. Call once at startup, before any other thread starts.
+static void
+record_columns_init() {
+    RecordColumnsHistogramFn* histogram_fn = record_columns_histogram_c;
+#if RECORD_COLUMNS_HAS_SIMD_PATH
+    if (record_columns_cpu_has_avx2()) {
+        histogram_fn = record_columns_histogram_avx2;
+    }
+    else if (record_columns_cpu_has_sse42()) {
+        histogram_fn = record_columns_histogram_sse42;
+    }
+#endif
+    g_record_columns_histogram_fn = histogram_fn;
+}
+
+// Adds to seconds[i] and counts[i] what was logged in [starts[i], starts[i + 1]).
+// Returns false if the columns could not be built.
+static bool32
+record_columns_histogram(RecordColumns* columns, TimeRecord* records, const uint16* tags, int64 num_records,
+                         int64* starts, int64 num_buckets, int64* seconds, int64* counts) {
+    if (!columns->built && !record_columns_build(columns, records, tags, num_records)) {
+        return false;
+    }
+    g_record_columns_histogram_fn(columns->timestamps, columns->elapsed, columns->count,
+                                  starts, num_buckets, seconds, counts);
+    return true;
+}
@@ -0,0 +1,305 @@
+// record_index.h
+//
+// Timestamp-sorted view of the records with running sums of elapsed seconds,
+// so "time logged since T" is a binary search and a subtraction. The main
+// index holds the focus records, every one but what named timers logged.
+//
+// Records are almost always appended in time order, which keeps appends and
+// edits or deletes of the last record O(1). Anything else patches the tail of
+// the arrays from the affected position on.
+//
+// The index is built on first use rather than at startup, though the first
+// use is usually right after startup. Building it is a pass over every record.
+
+#pragma once
+
+struct RecordIndex {
+    int64* timestamps;   // Sorted.
+    int64* cumulative;   // cumulative[i] is the elapsed sum of entries 0..i.
+    int64* record_ids;   // Position of each entry in TimerState::records.
+    int64 count;
+    int64 capacity;
+    bool32 built;
+};
+
+static void
+record_index_free(RecordIndex* index) {
+    free(index->timestamps);
+    free(index->cumulative);
+    free(index->record_ids);
+    *index = {};
+}
+
+static bool32
+record_index_reserve(RecordIndex* index, int64 count) {
+    if (count <= index->capacity) {
+        return true;
+    }
+    int64 capacity = index->capacity ? index->capacity : 1024;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    int64* timestamps = (int64*)realloc(index->timestamps, (size_t)capacity * sizeof(int64));
+    if (timestamps) {
+        index->timestamps = timestamps;
+    }
+    int64* cumulative = (int64*)realloc(index->cumulative, (size_t)capacity * sizeof(int64));
+    if (cumulative) {
+        index->cumulative = cumulative;
+    }
+    int64* record_ids = (int64*)realloc(index->record_ids, (size_t)capacity * sizeof(int64));
+    if (record_ids) {
+        index->record_ids = record_ids;
+    }
+    if (!timestamps || !cumulative || !record_ids) {
+        return false;
+    }
+    index->capacity = capacity;
+    return true;
+}
+
+// First position whose timestamp is >= t (or > t when after_equal is set).
+static int64
+record_index_search(RecordIndex* index, int64 t, bool32 after_equal) {
+    int64 lo = 0;
+    int64 hi = index->count;
+    while (lo < hi) {
+        int64 mid = lo + (hi - lo) / 2;
+        int64 ts = index->timestamps[mid];
+        if (ts < t || (after_equal && ts == t)) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void
+record_index_fix_sums(RecordIndex* index, TimeRecord* records, int64 from) {
+    int64 sum = from > 0 ? index->cumulative[from - 1] : 0;
+    for (int64 i = from; i < index->count; ++i) {
+        sum += records[index->record_ids[i]].elapsed;
+        index->cumulative[i] = sum;
+    }
+}
+
+// Where record_id sits in the index, or -1.
+static int64
+record_index_find(RecordIndex* index, TimeRecord* records, int64 record_id) {
+    if (index->count && index->record_ids[index->count - 1] == record_id) {
+        return index->count - 1;
+    }
+    for (int64 i = record_index_search(index, records[record_id].timestamp, false);
+         i < index->count && index->timestamps[i] == records[record_id].timestamp;
+         ++i) {
+        if (index->record_ids[i] == record_id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void
+record_index_insert(RecordIndex* index, TimeRecord* records, int64 record_id) {
+    if (!record_index_reserve(index, index->count + 1)) {
+        record_index_free(index);
+        return;
+    }
+    int64 t = records[record_id].timestamp;
+    int64 pos = index->count;
+    if (pos && index->timestamps[pos - 1] > t) {
+        pos = record_index_search(index, t, true);
+        size_t tail = (size_t)(index->count - pos) * sizeof(int64);
+        memmove(index->timestamps + pos + 1, index->timestamps + pos, tail);
+        memmove(index->record_ids + pos + 1, index->record_ids + pos, tail);
+    }
+    index->timestamps[pos] = t;
+    index->record_ids[pos] = record_id;
+    ++index->count;
+    record_index_fix_sums(index, records, pos);
+}
+
+// Takes records[record_id] out of an index that covers only some of the
+// records, like a tag's posting list.
+static void
+record_index_remove(RecordIndex* index, TimeRecord* records, int64 record_id) {
+    int64 pos = record_index_find(index, records, record_id);
+    if (pos < 0) {
+        record_index_free(index);
+        return;
+    }
+    size_t tail = (size_t)(index->count - pos - 1) * sizeof(int64);
+    memmove(index->timestamps + pos, index->timestamps + pos + 1, tail);
+    memmove(index->record_ids + pos, index->record_ids + pos + 1, tail);
+    --index->count;
+    record_index_fix_sums(index, records, pos);
+}
+
+// Stable merge sort of record ids by timestamp.
+static bool32
+record_index_sort_ids(int64* ids, int64 count, TimeRecord* records) {
+    int64* tmp = (int64*)malloc((size_t)(count ? count : 1) * sizeof(int64));
+    if (!tmp) {
+        return false;
+    }
+    int64* from = ids;
+    int64* to = tmp;
+    for (int64 width = 1; width < count; width *= 2) {
+        for (int64 lo = 0; lo < count; lo += 2 * width) {
+            int64 mid = lo + width < count ? lo + width : count;
+            int64 hi = lo + 2 * width < count ? lo + 2 * width : count;
+            int64 i = lo;
+            int64 j = mid;
+            for (int64 k = lo; k < hi; ++k) {
+                if (i < mid && (j >= hi || records[from[i]].timestamp <= records[from[j]].timestamp)) {
+                    to[k] = from[i++];
+                }
+                else {
+                    to[k] = from[j++];
+                }
+            }
+        }
+        int64* swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != ids) {
+        memcpy(ids, from, (size_t)count * sizeof(int64));
+    }
+    free(tmp);
+    return true;
+}
+
+// Indexes the focus records, all of them if tags is NULL.
+static bool32
+record_index_build(RecordIndex* index, TimeRecord* records, const uint16* tags, int64 num_records) {
+    record_index_free(index);
+    if (!record_index_reserve(index, num_records)) {
+        record_index_free(index);
+        return false;
+    }
+    bool32 sorted = true;
+    int64 count = 0;
+    for (int64 i = 0; i < num_records; ++i) {
+        if (!record_is_focus(tags, i)) {
+            continue;
+        }
+        if (count && records[i].timestamp < records[index->record_ids[count - 1]].timestamp) {
+            sorted = false;
+        }
+        index->record_ids[count++] = i;
+    }
+    if (!sorted && !record_index_sort_ids(index->record_ids, count, records)) {
+        record_index_free(index);
+        return false;
+    }
+    for (int64 i = 0; i < count; ++i) {
+        index->timestamps[i] = records[index->record_ids[i]].timestamp;
+    }
+    index->count = count;
+    index->built = true;
+    record_index_fix_sums(index, records, 0);
+    return true;
+}
+
+// Called after records[record_id] was appended.
+static void
+record_index_on_append(RecordIndex* index, TimeRecord* records, int64 record_id) {
+    if (index->built) {
+        record_index_insert(index, records, record_id);
+    }
+}
+
+// Called after records[record_id] was changed in place.
+static void
+record_index_on_edit(RecordIndex* index, TimeRecord* records, int64 record_id) {
+    if (!index->built) {
+        return;
+    }
+    int64 pos = record_index_find(index, records, record_id);
+    if (pos < 0) {
+        record_index_free(index);
+        return;
+    }
+    record_index_fix_sums(index, records, pos);
+}
+
+// Drops the entries of records from num_records on, at or after position
+// from, and fixes the sums after the first one dropped.
+static void
+record_index_drop_from(RecordIndex* index, TimeRecord* records, int64 num_records, int64 from) {
+    int64 kept = from;
+    int64 first_changed = -1;
+    for (int64 i = from; i < index->count; ++i) {
+        if (index->record_ids[i] < num_records) {
+            index->timestamps[kept] = index->timestamps[i];
+            index->record_ids[kept] = index->record_ids[i];
+            ++kept;
+        }
+        else if (first_changed < 0) {
+            first_changed = i;
+        }
+    }
+    index->count = kept;
+    if (first_changed >= 0) {
+        record_index_fix_sums(index, records, first_changed);
+    }
+}
+
+// Called after the records from num_records on were dropped, for an index of
+// all the focus records. tags still has the tags of the old_num_records
+// records there were.
+static void
+record_index_on_truncate(RecordIndex* index, TimeRecord* records, const uint16* tags,
+                         int64 old_num_records, int64 num_records) {
+    if (!index->built) {
+        return;
+    }
+    int64 num_dropped = 0;
+    for (int64 i = num_records; i < old_num_records; ++i) {
+        num_dropped += record_is_focus(tags, i);
+    }
+    // Usually the dropped records are the newest, at the end of the index.
+    while (num_dropped && index->count && index->record_ids[index->count - 1] >= num_records) {
+        --index->count;
+        --num_dropped;
+    }
+    if (num_dropped) {
+        record_index_drop_from(index, records, num_records, 0);
+    }
+}
+
+// Called after the records from num_records on were dropped, for an index
+// that covers only some of the records, like a tag's posting list. How many
+// of the dropped records it held doesn't follow from its count, so every
+// entry is checked.
+static void
+record_index_on_truncate_partial(RecordIndex* index, TimeRecord* records, int64 num_records) {
+    if (index->built) {
+        record_index_drop_from(index, records, num_records, 0);
+    }
+}
+
+// Sum of elapsed seconds of records with timestamp >= t. tags, which may be
+// NULL, is what an index that is not built yet gets built with.
+static int64
+record_index_seconds_since(RecordIndex* index, TimeRecord* records, const uint16* tags, int64 num_records,
+                           int64 t) {
+    if (!index->built && !record_index_build(index, records, tags, num_records)) {
+        int64 seconds = 0;
+        for (int64 i = 0; i < num_records; ++i) {
+            if (records[i].timestamp >= t && record_is_focus(tags, i)) {
+                seconds += records[i].elapsed;
+            }
+        }
+        return seconds;
+    }
+    if (!index->count) {
+        return 0;
+    }
+    int64 pos = record_index_search(index, t, false);
+    int64 before = pos > 0 ? index->cumulative[pos - 1] : 0;
+    return index->cumulative[index->count - 1] - before;
+}
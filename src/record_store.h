@@ -0,0 +1,150 @@
+// record_store.h
+//
+// Backing memory for TimerState::records.
+//
+// We reserve a large range of address space up front and commit it in fixed
+// RECORD_STORE_CHUNK_BYTES chunks as the history grows. Records never move,
+// so pointers into them stay valid, and the committed chunks sit back to back,
+// so TimerState::records stays one flat array that is walked with a plain
+// loop. Appending commits at most one chunk and never copies anything.
+//
+// On POSIX systems solanum.dat is mapped privately at the start of the range,
+// which saves copying it into memory we allocate. It doesn't make opening
+// lazy: the checksums of every block are verified right here, which reads the
+// whole file, so opening is linear in the history. Changes reach the disk
+// through the journal, never through the mapping.
+//
+// On Windows the snapshot is read into committed chunks of the range.
+
+#pragma once
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Address space reserved for the records. Only committed pages cost memory.
+#define RECORD_STORE_RESERVE ((size_t)1 << (sizeof(void*) == 8 ? 36 : 28))
+
+// Unit of growth. A multiple of the page size and of a cache line. It has no
+// relation to snapshot blocks: it holds about 6553 ten-byte records, not
+// 4096, and the records start at data_offset, past the snapshot header, so
+// neither records nor blocks line up with chunk boundaries.
+#define RECORD_STORE_CHUNK_BYTES ((size_t)64 * 1024)
+
+struct RecordStore {
+    uint8* base;
+    size_t committed_bytes;  // Readable and writable bytes starting at base.
+    size_t data_offset;      // Where the records start, past the snapshot header.
+};
+
+static void
+record_store_set_view(RecordStore* store, TimerState* state) {
+    state->records = (TimeRecord*)(store->base + store->data_offset);
+    state->records_size = store->committed_bytes > store->data_offset ?
+            (store->committed_bytes - store->data_offset) / sizeof(TimeRecord) : 0;
+}
+
+// Makes room for at least min_records records by committing whole chunks.
+static bool32
+record_store_grow(RecordStore* store, TimerState* state, size_t min_records) {
+    if (min_records <= state->records_size && store->base) {
+        return true;
+    }
+    size_t needed = store->data_offset + min_records * sizeof(TimeRecord);
+    size_t new_size = (needed + RECORD_STORE_CHUNK_BYTES - 1) & ~(RECORD_STORE_CHUNK_BYTES - 1);
+    if (new_size <= store->committed_bytes) {
+        new_size = store->committed_bytes + RECORD_STORE_CHUNK_BYTES;
+    }
+    if (new_size > RECORD_STORE_RESERVE) {
+        return false;
+    }
+#ifdef _WIN32
+    if (!VirtualAlloc(store->base + store->committed_bytes, new_size - store->committed_bytes,
+                      MEM_COMMIT, PAGE_READWRITE)) {
+        return false;
+    }
+#else
+    if (mprotect(store->base + store->committed_bytes, new_size - store->committed_bytes,
+                 PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+#endif
+    store->committed_bytes = new_size;
+    record_store_set_view(store, state);
+    return true;
+}
+
+// Maps or reads the snapshot at path and checks it. A missing file is an
+// empty history. Returns false only if we could not get memory for it;
+// info->num_valid records and their tags are loaded unless info->status is
+// CORRUPT. The tags are copied into state->tags, since they change as
+// records are appended past them.
+static bool32
+record_store_open(RecordStore* store, TimerState* state, const char* path, SnapshotInfo* info) {
+    *store = {};
+    *info = {};
+    state->num_records = 0;
+#ifdef _WIN32
+    store->base = (uint8*)VirtualAlloc(NULL, RECORD_STORE_RESERVE, MEM_RESERVE, PAGE_NOACCESS);
+    if (!store->base) {
+        return false;
+    }
+    FILE* fd = fopen(path, "rb");
+    if (fd) {
+        snapshot_read_info(fd, info);
+        if (info->status != SnapshotStatus_CORRUPT) {
+            if (!record_store_grow(store, state, (size_t)info->num_valid) ||
+                !tags_reserve(&state->tags, info->num_valid)) {
+                fclose(fd);
+                return false;
+            }
+            snapshot_read_records(fd, info, state->records, state->tags.record_tags);
+            state->num_records = info->num_valid;
+        }
+        fclose(fd);
+        return true;
+    }
+    return record_store_grow(store, state, 0);
+#else
+    void* base = mmap(NULL, RECORD_STORE_RESERVE, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    store->base = (uint8*)base;
+
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+            size_t file_size = (size_t)st.st_size;
+            size_t mapped_bytes = (file_size + page_size - 1) & ~(page_size - 1);
+            if (mapped_bytes > RECORD_STORE_RESERVE ||
+                mmap(store->base, mapped_bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+                close(fd);
+                return false;
+            }
+            store->committed_bytes = mapped_bytes;
+
+            snapshot_parse_header(store->base, file_size, (int64)file_size, info);
+            if (info->status != SnapshotStatus_CORRUPT) {
+                store->data_offset = (size_t)info->data_offset;
+                record_store_set_view(store, state);
+                snapshot_verify(info, (const uint32*)(store->base + sizeof(SnapshotHeader)), state->records);
+                if (!tags_reserve(&state->tags, info->num_valid)) {
+                    close(fd);
+                    return false;
+                }
+                snapshot_verify_tags(info, (const uint16*)(store->base + info->tags_offset),
+                                     state->tags.record_tags);
+                state->num_records = info->num_valid;
+            }
+        }
+        close(fd);
+    }
+    return record_store_grow(store, state, (size_t)state->num_records);
+#endif
+}
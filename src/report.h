@@ -0,0 +1,140 @@
+// report.h
+//
+// Text summaries of the logged time, for `solanum report` and
+// `solanum status`. Days, weeks and months are cells of the rollup tables;
+// the perspectives, which end at an arbitrary moment, go through the record
+// index and the merged records of the other machines. Once the history is
+// loaded, each total is a handful of cells or binary searches. Loading it is
+// not: the snapshot's checksums are verified and the record index is built,
+// each a pass over the whole history, so a report still takes time linear in
+// the history, just with a small constant.
+//
+// Days and weeks are in local time and weeks start on Monday. A record counts
+// for the moment it was stopped, like the perspective in the GUI. Per-project
+// totals go through each project's posting list in the same way, and only
+// count this machine's records: project ids mean nothing on another machine.
+
+#pragma once
+
+#define REPORT_NUM_DAYS 7
+#define REPORT_NUM_WEEKS 4
+#define REPORT_NUM_MONTHS 6
+
+// Seconds logged in [from, to).
+static int64
+report_seconds_between(TimerState* state, int64 from, int64 to) {
+    uint16* tags = state->tags.record_tags;
+    return record_index_seconds_since(&state->index, state->records, tags, state->num_records, from) -
+            record_index_seconds_since(&state->index, state->records, tags, state->num_records, to) +
+            history_merge_seconds_since(&state->peers, from) - history_merge_seconds_since(&state->peers, to);
+}
+
+static void
+report_print_line(const char* label, int64 seconds) {
+    printf("  %-18s %4lldh %02lldm %02llds\n", label,
+           (long long)(seconds / (60 * 60)), (long long)((seconds / 60) % 60), (long long)(seconds % 60));
+}
+
+// Per project: this week, then all time.
+static void
+report_print_projects(TimerState* state, int64 end) {
+    Tags* tags = &state->tags;
+    int64 this_week = rollup_period_of_day(RollupPeriod_WEEK, rollup_table_day(&state->rollups, end - 1));
+    int64 week_start = day_table_start(&state->rollups.days, rollup_first_day(RollupPeriod_WEEK, this_week));
+    bool32 any = false;
+    for (int tag = 1; tag < tags->table.num_tags; ++tag) {
+        int64 total = tags_seconds_between(tags, state->records, state->num_records, (uint16)tag, INT64_MIN, end);
+        if (!total) {
+            continue;
+        }
+        if (!any) {
+            printf("Projects              this week        all time\n");
+            any = true;
+        }
+        int64 week = tags_seconds_between(tags, state->records, state->num_records, (uint16)tag, week_start, end);
+        printf("  %-18s %4lldh %02lldm %02llds %6lldh %02lldm %02llds\n", tag_name(&tags->table, (uint16)tag),
+               (long long)(week / (60 * 60)), (long long)((week / 60) % 60), (long long)(week % 60),
+               (long long)(total / (60 * 60)), (long long)((total / 60) % 60), (long long)(total % 60));
+    }
+}
+
+// Seconds in the cell of each period number from `number` back.
+static void
+report_print_periods(RollupTable* rollups, RollupPeriod period, int64 number, int count, const char* format) {
+    char label[TEXT_BUFFER_SIZE];
+    for (int i = 0; i < count; ++i) {
+        time_t time = (time_t)day_table_start(&rollups->days, rollup_first_day(period, number - i));
+        strftime(label, sizeof(label), format, localtime(&time));
+        report_print_line(label, rollup_table_get(rollups, period, number - i).seconds);
+    }
+}
+
+static void
+report_print(TimerState* state, int64 now) {
+    // Past the last record, so anything stopped this second is included.
+    int64 end = now + 1;
+    RollupTable* rollups = &state->rollups;
+    int64 today = rollup_table_day(rollups, now);
+
+    printf("Perspective\n");
+    report_print_line("Last hour", report_seconds_between(state, now - 1 * 60 * 60, end));
+    report_print_line("Last 8 hours", report_seconds_between(state, now - 8 * 60 * 60, end));
+    report_print_line("Last 24 hours", report_seconds_between(state, now - 24 * 60 * 60, end));
+
+    printf("Days\n");
+    report_print_periods(rollups, RollupPeriod_DAY, today, REPORT_NUM_DAYS, "%a %Y-%m-%d");
+    printf("Weeks\n");
+    report_print_periods(rollups, RollupPeriod_WEEK, rollup_period_of_day(RollupPeriod_WEEK, today),
+                         REPORT_NUM_WEEKS, "From %Y-%m-%d");
+
+    report_print_projects(state, end);
+
+    printf("Months\n");
+    report_print_periods(rollups, RollupPeriod_MONTH, rollup_period_of_day(RollupPeriod_MONTH, today),
+                         REPORT_NUM_MONTHS, "%B %Y");
+
+    // Weekdays and streaks from the day cells, which are one per day logged
+    // or in between: a few thousand for a decade.
+    RollupSeries* days = &rollups->series[RollupPeriod_DAY];
+    int64 weekday_seconds[7] = {};
+    int64 total_seconds = 0;
+    int64 streak = 0;
+    int64 longest_streak = 0;
+    for (int64 i = 0; i < days->num_cells; ++i) {
+        int64 seconds = days->cells[i].seconds;
+        weekday_seconds[day_weekday(days->first + i)] += seconds;
+        total_seconds += seconds;
+        streak = seconds > 0 ? streak + 1 : 0;
+        longest_streak = streak > longest_streak ? streak : longest_streak;
+    }
+    // The current streak ends today or, if nothing was logged yet today,
+    // yesterday.
+    int64 current_streak = 0;
+    int64 day = rollup_table_get(rollups, RollupPeriod_DAY, today).seconds > 0 ? today : today - 1;
+    while (rollup_table_get(rollups, RollupPeriod_DAY, day).seconds > 0) {
+        ++current_streak;
+        --day;
+    }
+
+    printf("Weekdays\n");
+    const char* weekdays[] = { "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday", "Sunday" };
+    for (int weekday = 0; weekday < 7; ++weekday) {
+        report_print_line(weekdays[weekday], weekday_seconds[weekday]);
+    }
+
+    printf("Streaks\n");
+    printf("  %-18s %4lld days\n", "Current", (long long)current_streak);
+    printf("  %-18s %4lld days\n", "Longest", (long long)longest_streak);
+
+    printf("Total\n");
+    report_print_line("All time", total_seconds);
+}
+
+// One line, for status bars.
+static void
+report_print_status(TimerState* state, int64 now) {
+    char buffer[TEXT_BUFFER_SIZE];
+    RollupCell today = rollup_table_get_at(&state->rollups, RollupPeriod_DAY, now);
+    format_seconds(buffer, "Today", (int)today.seconds);
+    printf("%s\n", buffer);
+}
@@ -0,0 +1,416 @@
+// rollup_table.h
+//
+// Seconds logged and number of focus records per local day, ISO week and
+// calendar month, kept up to date as records are appended, edited and deleted, so a
+// total over any of those periods is one lookup.
+//
+// Periods are numbered from the Unix epoch in the local calendar: day 0 is
+// 1970-01-01, week 0 is the one starting Monday 1969-12-29, month 0 is
+// January 1970. Each period has a series of cells, one per number from the
+// first one that has a record on. Records come in time order, so the series
+// grow at the end. The day of a record comes from the day table, and only
+// when it falls on another day than the one before. Building the tables from
+// scratch sums whole days at a time over the record columns instead.
+//
+// The tables are saved to solanum.rollups on exit, and whenever the journal
+// is compacted:
+//
+//   RollupFileHeader
+//   RollupCell cells[]   The day series, then the week and the month series.
+//
+// They describe the first num_records records. On load the header has to
+// match those records, down to a checksum of them and their tags, since an
+// edit can land anywhere after the tables were saved; any records after them
+// are then applied, which covers a session that ended without saving the
+// tables. Anything else, including a change of time zone, builds the tables
+// again from the records.
+
+#pragma once
+
+#define ROLLUP_FILE_MAGIC 0x50555253  // "SRUP"
+#define ROLLUP_FILE_VERSION 3  // v1 counted named timers' records, v2 had no records_crc.
+
+enum RollupPeriod {
+    RollupPeriod_DAY,
+    RollupPeriod_WEEK,
+    RollupPeriod_MONTH,
+    RollupPeriod_COUNT,
+};
+
+struct RollupCell {
+    int64 seconds;
+    int64 count;
+};
+
+struct RollupSeries {
+    int64 first;  // Number of the period in cells[0].
+    int64 num_cells;
+    int64 capacity;
+    RollupCell* cells;
+};
+
+struct RollupTable {
+    RollupSeries series[RollupPeriod_COUNT];
+    DayTable days;
+    uint32 version;   // Bumped on every change, for views that cache what they show.
+    bool32 damaged;   // A cell could not be allocated. Never saved.
+
+    // The local day of the last timestamp looked up, where it starts and
+    // ends, and the number of its day, week and month.
+    int64 cached_day;
+    int64 cached_begin;
+    int64 cached_end;
+    int64 cached_numbers[RollupPeriod_COUNT];
+};
+
+struct RollupFileHeader {
+    uint32 magic;
+    uint32 version;
+    int64 num_records;
+    int64 last_timestamp;  // Of record num_records - 1.
+    int64 last_elapsed;
+    int64 last_day_start;  // Local midnight of its day, which moves with the time zone.
+    int64 first[RollupPeriod_COUNT];
+    int64 num_cells[RollupPeriod_COUNT];
+    uint32 crc;          // CRC32C of the cells.
+    uint32 records_crc;  // CRC32C of the first num_records records, then of their tags.
+};
+
+// The number of the week or month that day is in.
+static int64
+rollup_period_of_day(RollupPeriod period, int64 day) {
+    switch (period) {
+        case RollupPeriod_WEEK: {
+            return day_floor_div(day + 3, 7);
+        } break;
+        case RollupPeriod_MONTH: {
+            int64 year;
+            int month;
+            int day_of_month;
+            day_to_civil(day, &year, &month, &day_of_month);
+            return (year - 1970) * 12 + month - 1;
+        } break;
+        default: break;
+    }
+    return day;
+}
+
+// The first day of a period.
+static int64
+rollup_first_day(RollupPeriod period, int64 number) {
+    switch (period) {
+        case RollupPeriod_WEEK: {
+            return number * 7 - 3;
+        } break;
+        case RollupPeriod_MONTH: {
+            int64 year = 1970 + day_floor_div(number, 12);
+            return day_from_civil(year, (int)(number - (year - 1970) * 12) + 1, 1);
+        } break;
+        default: break;
+    }
+    return number;
+}
+
+// The local day t is in.
+static int64
+rollup_table_day(RollupTable* table, int64 t) {
+    if (t >= table->cached_begin && t < table->cached_end) {
+        return table->cached_day;
+    }
+    DayTable* days = &table->days;
+    int64 day = day_table_day(days, t);
+    table->cached_day = day;
+    if (day >= days->first && day < days->first + days->num_days) {
+        table->cached_begin = days->starts[day - days->first];
+        table->cached_end = days->starts[day - days->first + 1];
+    }
+    else {
+        // Out of memory for the day table. Don't cache anything.
+        table->cached_begin = 0;
+        table->cached_end = 0;
+    }
+    for (int period = 0; period < RollupPeriod_COUNT; ++period) {
+        table->cached_numbers[period] = rollup_period_of_day((RollupPeriod)period, day);
+    }
+    return day;
+}
+
+// Empties the series, keeping the day table.
+static void
+rollup_table_clear(RollupTable* table) {
+    for (int period = 0; period < RollupPeriod_COUNT; ++period) {
+        free(table->series[period].cells);
+        table->series[period] = {};
+    }
+    table->damaged = false;
+    table->cached_begin = 0;
+    table->cached_end = 0;
+}
+
+static void
+rollup_table_free(RollupTable* table) {
+    for (int period = 0; period < RollupPeriod_COUNT; ++period) {
+        free(table->series[period].cells);
+    }
+    day_table_free(&table->days);
+    *table = {};
+}
+
+static bool32
+rollup_series_reserve(RollupSeries* series, int64 count) {
+    if (count <= series->capacity) {
+        return true;
+    }
+    int64 capacity = series->capacity ? series->capacity : 64;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    RollupCell* cells = (RollupCell*)realloc(series->cells, (size_t)capacity * sizeof(RollupCell));
+    if (!cells) {
+        return false;
+    }
+    series->cells = cells;
+    series->capacity = capacity;
+    return true;
+}
+
+// The cell of period `number`, adding empty cells up to it if needed.
+// NULL when out of memory.
+static RollupCell*
+rollup_series_cell(RollupSeries* series, int64 number) {
+    if (!series->num_cells) {
+        series->first = number;
+    }
+    if (number < series->first) {
+        int64 shift = series->first - number;
+        if (!rollup_series_reserve(series, series->num_cells + shift)) {
+            return NULL;
+        }
+        memmove(series->cells + shift, series->cells, (size_t)series->num_cells * sizeof(RollupCell));
+        memset(series->cells, 0, (size_t)shift * sizeof(RollupCell));
+        series->first = number;
+        series->num_cells += shift;
+    }
+    else if (number >= series->first + series->num_cells) {
+        int64 count = number - series->first + 1;
+        if (!rollup_series_reserve(series, count)) {
+            return NULL;
+        }
+        memset(series->cells + series->num_cells, 0, (size_t)(count - series->num_cells) * sizeof(RollupCell));
+        series->num_cells = count;
+    }
+    return &series->cells[number - series->first];
+}
+
+// Adds a record to its cells, or takes it out again with sign -1.
+static void
+rollup_table_apply(RollupTable* table, TimeRecord record, int sign) {
+    rollup_table_day(table, record.timestamp);
+    for (int period = 0; period < RollupPeriod_COUNT; ++period) {
+        RollupCell* cell = rollup_series_cell(&table->series[period], table->cached_numbers[period]);
+        if (!cell) {
+            table->damaged = true;
+            continue;
+        }
+        cell->seconds += sign * record.elapsed;
+        cell->count += sign;
+    }
+    ++table->version;
+}
+
+// Adds per-day sums for the days from first_day on to the cells.
+static void
+rollup_table_add_days(RollupTable* table, int64 first_day, int64* seconds, int64* counts, int64 num_days) {
+    for (int64 i = 0; i < num_days; ++i) {
+        if (!counts[i]) {
+            continue;
+        }
+        for (int period = 0; period < RollupPeriod_COUNT; ++period) {
+            int64 number = rollup_period_of_day((RollupPeriod)period, first_day + i);
+            RollupCell* cell = rollup_series_cell(&table->series[period], number);
+            if (!cell) {
+                table->damaged = true;
+                continue;
+            }
+            cell->seconds += seconds[i];
+            cell->count += counts[i];
+        }
+    }
+}
+
+// Sums the records per day over the columns, a few records per instruction,
+// and adds the days up into weeks and months. Falls back to applying the
+// records one by one if there is no memory for the columns or the day sums.
+static void
+rollup_table_build(RollupTable* table, RecordColumns* columns, TimeRecord* records, const uint16* tags,
+                   int64 num_records) {
+    rollup_table_clear(table);
+    bool32 done = !num_records;
+    if (!done && (columns->built || record_columns_build(columns, records, tags, num_records))) {
+        int64 min_timestamp = INT64_MAX;
+        int64 max_timestamp = INT64_MIN;
+        for (int64 i = 0; i < columns->count; ++i) {
+            int64 t = columns->timestamps[i];
+            if (t == RECORD_COLUMNS_LEFT_OUT) {
+                continue;
+            }
+            min_timestamp = t < min_timestamp ? t : min_timestamp;
+            max_timestamp = t > max_timestamp ? t : max_timestamp;
+        }
+        DayTable* days = &table->days;
+        int64* day_sums = NULL;
+        if (min_timestamp > max_timestamp) {
+            // Nothing but named timers' records.
+            done = true;
+        }
+        else if (day_table_cover(days, day_floor_div(min_timestamp, DAY_SECONDS) - 1,
+                                 day_floor_div(max_timestamp, DAY_SECONDS) + 2) &&
+                 (day_sums = (int64*)calloc((size_t)days->num_days * 2, sizeof(int64))) != NULL &&
+                 record_columns_histogram(columns, records, tags, num_records, days->starts, days->num_days,
+                                          day_sums, day_sums + days->num_days)) {
+            rollup_table_add_days(table, days->first, day_sums, day_sums + days->num_days, days->num_days);
+            done = true;
+        }
+        free(day_sums);
+    }
+    for (int64 i = 0; !done && i < num_records; ++i) {
+        if (record_is_focus(tags, i)) {
+            rollup_table_apply(table, records[i], 1);
+        }
+    }
+    ++table->version;
+}
+
+static void
+rollup_table_on_edit(RollupTable* table, TimeRecord old_record, TimeRecord record) {
+    rollup_table_apply(table, old_record, -1);
+    rollup_table_apply(table, record, 1);
+}
+
+// Called before the records from num_records on are dropped.
+static void
+rollup_table_on_truncate(RollupTable* table, TimeRecord* records, const uint16* tags,
+                         int64 old_num_records, int64 num_records) {
+    for (int64 i = num_records; i < old_num_records; ++i) {
+        if (record_is_focus(tags, i)) {
+            rollup_table_apply(table, records[i], -1);
+        }
+    }
+}
+
+// Drops the day table and builds the tables again if the time zone changed
+// since the days were found. Returns true if it did.
+static bool32
+rollup_table_check_zone(RollupTable* table, RecordColumns* columns, TimeRecord* records, const uint16* tags,
+                        int64 num_records) {
+    if (!day_table_check_zone(&table->days)) {
+        return false;
+    }
+    rollup_table_build(table, columns, records, tags, num_records);
+    return true;
+}
+
+// The cell of period `number`. Empty if nothing was logged in it.
+static RollupCell
+rollup_table_get(RollupTable* table, RollupPeriod period, int64 number) {
+    RollupSeries* series = &table->series[period];
+    RollupCell cell = {};
+    if (number >= series->first && number < series->first + series->num_cells) {
+        cell = series->cells[number - series->first];
+    }
+    return cell;
+}
+
+// The cell of the period t is in.
+static RollupCell
+rollup_table_get_at(RollupTable* table, RollupPeriod period, int64 t) {
+    return rollup_table_get(table, period, rollup_period_of_day(period, rollup_table_day(table, t)));
+}
+
+static uint32
+rollup_table_crc(RollupTable* table) {
+    uint32 crc = 0;
+    for (int period = 0; period < RollupPeriod_COUNT; ++period) {
+        RollupSeries* series = &table->series[period];
+        crc = crc32c(crc, series->cells, (size_t)series->num_cells * sizeof(RollupCell));
+    }
+    return crc;
+}
+
+static uint32
+rollup_table_records_crc(TimeRecord* records, const uint16* tags, int64 num_records) {
+    uint32 crc = crc32c(0, records, (size_t)num_records * sizeof(TimeRecord));
+    return tags ? crc32c(crc, tags, (size_t)num_records * sizeof(uint16)) : crc;
+}
+
+// records and tags are the ones the table was built from.
+static bool32
+rollup_table_write(FILE* fd, RollupTable* table, TimeRecord* records, const uint16* tags, int64 num_records) {
+    if (table->damaged) {
+        return false;
+    }
+    RollupFileHeader header = {};
+    header.magic = ROLLUP_FILE_MAGIC;
+    header.version = ROLLUP_FILE_VERSION;
+    header.num_records = num_records;
+    if (num_records) {
+        TimeRecord last = records[num_records - 1];
+        header.last_timestamp = last.timestamp;
+        header.last_elapsed = last.elapsed;
+        header.last_day_start = day_table_start(&table->days, rollup_table_day(table, last.timestamp));
+    }
+    for (int period = 0; period < RollupPeriod_COUNT; ++period) {
+        header.first[period] = table->series[period].first;
+        header.num_cells[period] = table->series[period].num_cells;
+    }
+    header.crc = rollup_table_crc(table);
+    header.records_crc = rollup_table_records_crc(records, tags, num_records);
+    bool32 ok = fwrite(&header, sizeof(header), 1, fd) == 1;
+    for (int period = 0; ok && period < RollupPeriod_COUNT; ++period) {
+        RollupSeries* series = &table->series[period];
+        ok = fwrite(series->cells, sizeof(RollupCell), (size_t)series->num_cells, fd) == (size_t)series->num_cells;
+    }
+    return ok;
+}
+
+// Reads tables that were written for a prefix of records and applies the
+// records after it. Returns false, with the table empty, if fd holds
+// nothing we can use.
+static bool32
+rollup_table_read(FILE* fd, RollupTable* table, TimeRecord* records, const uint16* tags, int64 num_records) {
+    rollup_table_clear(table);
+    RollupFileHeader header = {};
+    if (fread(&header, sizeof(header), 1, fd) != 1 ||
+        header.magic != ROLLUP_FILE_MAGIC || header.version != ROLLUP_FILE_VERSION ||
+        header.num_records < 0 || header.num_records > num_records) {
+        return false;
+    }
+    if (header.num_records) {
+        TimeRecord last = records[header.num_records - 1];
+        if (last.timestamp != header.last_timestamp || last.elapsed != header.last_elapsed ||
+            day_table_start(&table->days, rollup_table_day(table, last.timestamp)) != header.last_day_start ||
+            rollup_table_records_crc(records, tags, header.num_records) != header.records_crc) {
+            return false;
+        }
+    }
+    bool32 ok = true;
+    for (int period = 0; ok && period < RollupPeriod_COUNT; ++period) {
+        RollupSeries* series = &table->series[period];
+        ok = header.num_cells[period] >= 0 && rollup_series_reserve(series, header.num_cells[period]) &&
+                fread(series->cells, sizeof(RollupCell), (size_t)header.num_cells[period], fd) ==
+                (size_t)header.num_cells[period];
+        series->first = header.first[period];
+        series->num_cells = ok ? header.num_cells[period] : 0;
+    }
+    if (!ok || rollup_table_crc(table) != header.crc) {
+        rollup_table_clear(table);
+        return false;
+    }
+    for (int64 i = header.num_records; i < num_records; ++i) {
+        if (record_is_focus(tags, i)) {
+            rollup_table_apply(table, records[i], 1);
+        }
+    }
+    ++table->version;
+    return true;
+}
@@ -12,25 +12,52 @@
 #ifndef _WIN32
 #define MAX_PATH 1024
 #include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
 #elif defined(_WIN32)
 #include <windows.h>
+#include <io.h>
 #endif
 #include <errno.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
 
 #if defined(__MACH__)
 #include <mach-o/dyld.h>
+#include <mach/mach_time.h>
 #endif
 
 // Platform services:
-void platform_alert();
+void platform_alert(const char* message);
 void platform_quit();
 struct TimerState;
 void platform_save_state(TimerState* state);
+bool platform_grow_records(TimerState* state);
+int64_t platform_monotonic_ns();
+int64_t platform_suspended_ns();
+bool platform_save_failed();
+void platform_save_tag_names(TimerState* state);
 
 #include "solanum.h"
+#include "crc32c.h"
+#include "file_helpers.h"
+#include "snapshot.h"
+#include "journal.h"
+#include "peers.h"
+#include "record_store.h"
+#include "backup.h"
+#include "archive.h"
+#include "io_queue.h"
+#include "report.h"
+#include "profiler.h"
 
 
 static TimerState g_timer_state;
+static RecordStore g_record_store;
 bool32 g_running = true;
 bool32 g_alert_flag;
 
@@ -39,9 +66,122 @@ platform_quit() {
     g_running = false;
 }
 
+// Desktop notifications are on unless SOLANUM_NOTIFY is set to 0.
+static bool32 g_notify_desktop = true;
+
+static void
+notify_init() {
+    const char* env = getenv("SOLANUM_NOTIFY");
+    g_notify_desktop = !env || strcmp(env, "0") != 0;
+}
+
+#ifndef _WIN32
+extern char** environ;
+
+// Desktop notification for when the window is buried. Runs on its own thread
+// so a slow or missing notification daemon never holds up a frame. The
+// message is passed as an argument, never through a shell, since it holds
+// the name of a timer. Takes ownership of the malloc'd message.
+static int
+notify_desktop(void* data) {
+    char* message = (char*)data;
+#if defined(__linux__)
+    char* argv[] = { (char*)"notify-send", (char*)"-a", (char*)"Solanum", (char*)"Solanum", message, NULL };
+#elif defined(__MACH__)
+    char* argv[] = { (char*)"osascript",
+                     (char*)"-e", (char*)"on run argv",
+                     (char*)"-e", (char*)"display notification (item 1 of argv) with title \"Solanum\"",
+                     (char*)"-e", (char*)"end run",
+                     message, NULL };
+#else
+    char* argv[] = { NULL };
+#endif
+    if (argv[0]) {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+        pid_t pid;
+        if (posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ) == 0) {
+            waitpid(pid, NULL, 0);
+        }
+        posix_spawn_file_actions_destroy(&actions);
+    }
+    free(message);
+    return 0;
+}
+#endif
+
+// The in-window toast is drawn by timer_step_and_render. This adds whatever
+// the desktop offers, without ever blocking.
 void 
-platform_alert() {
+platform_alert(const char* message) {
     g_alert_flag = true;
+#ifndef _WIN32
+    char* copy = g_notify_desktop ? strdup(message) : NULL;
+    SDL_Thread* thread = copy ? SDL_CreateThread(notify_desktop, "solanum_notify", copy) : NULL;
+    if (thread) {
+        SDL_DetachThread(thread);
+    }
+    else {
+        free(copy);
+    }
+#endif
+}
+
+#if defined(__linux__)
+static int64
+clock_ns(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (int64)ts.tv_sec * NS_PER_SECOND + (int64)ts.tv_nsec;
+}
+#elif defined(__MACH__)
+static int64
+mach_ticks_to_ns(uint64 ticks) {
+    static mach_timebase_info_data_t timebase;
+    if (!timebase.denom) {
+        mach_timebase_info(&timebase);
+    }
+    return (int64)(ticks * timebase.numer / timebase.denom);
+}
+#endif
+
+// Time the machine has been awake. Never goes backwards, whatever happens to
+// the wall clock, and stands still while the machine is suspended.
+int64
+platform_monotonic_ns() {
+#if defined(__linux__)
+    return clock_ns(CLOCK_MONOTONIC);
+#elif defined(__MACH__)
+    return mach_ticks_to_ns(mach_absolute_time());
+#elif defined(_WIN32)
+    ULONGLONG unbiased;
+    QueryUnbiasedInterruptTime(&unbiased);
+    return (int64)unbiased * 100;
+#endif
+}
+
+// Total time the machine has been suspended since it booted: the difference
+// between a clock that counts suspend and one that doesn't.
+int64
+platform_suspended_ns() {
+#if defined(__linux__)
+    int64 awake = clock_ns(CLOCK_MONOTONIC);
+    return clock_ns(CLOCK_BOOTTIME) - awake;
+#elif defined(__MACH__)
+    uint64 awake = mach_absolute_time();
+    return mach_ticks_to_ns(mach_continuous_time() - awake);
+#elif defined(_WIN32)
+    ULONGLONG unbiased;
+    QueryUnbiasedInterruptTime(&unbiased);
+    return (int64)GetTickCount64() * 1000 * 1000 - (int64)unbiased * 100;
+#endif
+}
+
+bool
+platform_grow_records(TimerState* state) {
+    return record_store_grow(&g_record_store, state, (size_t)state->num_records + 1);
 }
 
 void 
@@ -99,108 +239,1046 @@ path_at_exe(char* full_path, int buffer_size, char* fname) {
 #endif
 }
 
-int 
-cp(const char *from, const char *to) {
-#ifdef _WIN32
-    CopyFile(from, to, FALSE);
-    return 0;
+// Machines sharing the data directory each keep their own files in it, named
+// after the machine, and merge in everyone else's (see peers.h).
+#define MACHINE_NAME_MAX 32
+
+static char g_machine[MACHINE_NAME_MAX + 1];
+
+// SOLANUM_MACHINE if set, else the host name up to the first dot. Only
+// letters, digits, '-' and '_' are kept, so it is safe in a file name.
+static void
+machine_init() {
+    char name[MERGE_NAME_SIZE] = {};
+    const char* env = getenv("SOLANUM_MACHINE");
+    if (env && env[0]) {
+        snprintf(name, MERGE_NAME_SIZE, "%s", env);
+    }
+    else {
+#if defined(_WIN32)
+        DWORD size = MERGE_NAME_SIZE;
+        GetComputerNameA(name, &size);
 #else
-    int fd_to, fd_from;
-    char buf[4096];
-    size_t nread;
-    int saved_errno;
+        gethostname(name, MERGE_NAME_SIZE - 1);
+#endif
+    }
+    int len = 0;
+    for (int i = 0; name[i] && name[i] != '.' && len < MACHINE_NAME_MAX; ++i) {
+        char c = name[i];
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_') {
+            g_machine[len++] = c;
+        }
+    }
+    if (!len) {
+        snprintf(g_machine, sizeof(g_machine), "default");
+    }
+}
 
-    fd_from = open(from, O_RDONLY);
-    if (fd_from < 0)
-        return -1;
+// One of this machine's files: solanum-<machine><suffix> in the data directory.
+static void
+machine_path(char* full_path, int buffer_size, const char* suffix) {
+    char name[MAX_PATH];
+    snprintf(name, MAX_PATH, PEER_FILE_PREFIX "%s%s", g_machine, suffix);
+    path_at_exe(full_path, buffer_size, name);
+}
+
+static bool32
+machine_has_own_files() {
+    char path[MAX_PATH];
+    struct stat st;
+    machine_path(path, MAX_PATH, ".dat");
+    bool32 has_own = stat(path, &st) == 0;
+    machine_path(path, MAX_PATH, ".jnl");
+    return has_own || stat(path, &st) == 0;
+}
+
+// All machines used to write solanum.dat and solanum.jnl. A machine without
+// files of its own starts from a copy of them. Every machine makes its own
+// copy, and the merge drops the sessions they have in common. Only commands
+// that write adopt them; the others read the shared files in place.
+static void
+machine_adopt_legacy_files() {
+    if (machine_has_own_files()) {
+        return;
+    }
+    char path[MAX_PATH];
+    const char* suffixes[] = { ".dat", ".jnl", ".tags" };
+    for (int i = 0; i < (int)(sizeof(suffixes) / sizeof(suffixes[0])); ++i) {
+        char legacy_name[MAX_PATH];
+        char legacy_path[MAX_PATH];
+        snprintf(legacy_name, MAX_PATH, "solanum%s", suffixes[i]);
+        path_at_exe(legacy_path, MAX_PATH, legacy_name);
+        machine_path(path, MAX_PATH, suffixes[i]);
+        size_t size = 0;
+        uint8* data = backup_read_file(legacy_path, &size);
+        if (data && !backup_write_file(path, NULL, 0, data, size)) {
+            printf("Could not copy %s to %s\n", legacy_path, path);
+        }
+        free(data);
+    }
+}
+
+// Journal state shared between the UI thread and the maintenance thread,
+// which compacts the journal and takes backup points, one job at a time.
+struct Journal {
+    FILE* fd;
+    int64 num_entries;
+    SDL_mutex* mutex;
+    SDL_Thread* maintenance_thread;
+    SDL_atomic_t busy;
+    bool32 compact;           // The jobs of the running maintenance thread.
+    bool32 back_up;
+    int64 last_backup;        // Time of the newest backup point. Under mutex.
+    char data_path[MAX_PATH];
+    char journal_path[MAX_PATH];
+    char tags_path[MAX_PATH];
+    char rollups_path[MAX_PATH];
+};
 
-    fd_to = open(to, O_WRONLY | O_CREAT | O_EXCL, 0666);
-    if (fd_to < 0)
-        goto out_error;
+static Journal g_journal;
 
-    while (nread = read(fd_from, buf, sizeof buf), nread > 0)
+// A backup point at most this many seconds old is recent enough.
+#define BACKUP_INTERVAL (60 * 60)
+
+// Reads this machine's snapshot and the first folded_bytes of its journal
+// into malloc'd arrays. Only touches the files.
+static bool32
+journal_read_history(int64 folded_bytes, TimeRecord** out_records, uint16** out_tags, int64* out_num_records) {
+    int64 num_records = 0;
+    TimeRecord* records = NULL;
+    uint16* tags = NULL;
+    bool32 ok = false;
+    size_t records_size = 0;
     {
-        char *out_ptr = buf;
-        size_t nwritten;
+        SnapshotInfo info = {};
+        FILE* fd = fopen(g_journal.data_path, "rb");
+        if (fd) {
+            snapshot_read_info(fd, &info);
+        }
+        records_size = (size_t)info.num_valid + (size_t)(folded_bytes / (int64)sizeof(JournalEntry)) + 1;
+        records = (TimeRecord*)malloc(records_size * sizeof(TimeRecord));
+        tags = (uint16*)malloc(records_size * sizeof(uint16));
+        if (records && tags && fd) {
+            snapshot_read_records(fd, &info, records, tags);
+            num_records = info.num_valid;
+        }
+        // Never fold anything into a snapshot we could not verify.
+        ok = records && tags && info.status != SnapshotStatus_CORRUPT;
+        if (fd) {
+            fclose(fd);
+        }
+    }
+    if (ok) {
+        FILE* fd = fopen(g_journal.journal_path, "rb");
+        int64 num_entries = 0;
+        ok = fd && journal_replay(fd, folded_bytes, records, tags, records_size, &num_records, &num_entries,
+                                  false) > 0;
+        if (fd) {
+            fclose(fd);
+        }
+    }
+    if (!ok) {
+        free(records);
+        free(tags);
+        return false;
+    }
+    *out_records = records;
+    *out_tags = tags;
+    *out_num_records = num_records;
+    return true;
+}
 
-        do {
-            nwritten = write(fd_to, out_ptr, nread);
+// Saves tables built from records and tags, which are this machine's only,
+// to solanum.rollups.
+static bool32
+rollups_write(RollupTable* rollups, TimeRecord* records, const uint16* tags, int64 num_records) {
+    char tmp_path[MAX_PATH];
+    bool32 ok = backup_path_fits(snprintf(tmp_path, MAX_PATH, "%s.tmp", g_journal.rollups_path));
+    FILE* fd = ok ? fopen(tmp_path, "wb") : NULL;
+    ok = fd && rollup_table_write(fd, rollups, records, tags, num_records);
+    if (fd) {
+        ok = flush_to_disk(fd) && ok;
+        fclose(fd);
+    }
+    return ok && replace_file(tmp_path, g_journal.rollups_path);
+}
 
-            if (nwritten >= 0)
-            {
-                nread -= nwritten;
-                out_ptr += nwritten;
+// How much of the journal is on disk, for journal_read_history.
+static int64
+journal_flushed_bytes() {
+    SDL_LockMutex(g_journal.mutex);
+    fflush(g_journal.fd);
+    int64 flushed_bytes = (int64)ftell(g_journal.fd);
+    SDL_UnlockMutex(g_journal.mutex);
+    return flushed_bytes;
+}
+
+// Folds the current journal into this machine's snapshot. Only touches the
+// files, so the UI can keep appending while it works. Entries appended after
+// we start are carried over into the new journal.
+static bool32
+journal_compact() {
+    int64 folded_bytes = journal_flushed_bytes();
+    int64 num_records = 0;
+    TimeRecord* records = NULL;
+    uint16* tags = NULL;
+    bool32 ok = journal_read_history(folded_bytes, &records, &tags, &num_records);
+
+    char tmp_path[MAX_PATH];
+    if (ok) {
+        machine_path(tmp_path, MAX_PATH, ".dat.tmp");
+        FILE* fd = fopen(tmp_path, "wb");
+        ok = fd && snapshot_write(fd, records, tags, num_records);
+        if (fd) {
+            flush_to_disk(fd);
+            fclose(fd);
+        }
+        ok = ok && replace_file(tmp_path, g_journal.data_path);
+    }
+    // Tables for the history we just folded, so a session that ends without
+    // saving them costs catching up on the journal rather than a full build.
+    // The UI's own tables also count the other machines, so these are built
+    // apart from them.
+    if (ok) {
+        RollupTable rollups = {};
+        RecordColumns columns = {};
+        rollup_table_build(&rollups, &columns, records, tags, num_records);
+        if (!rollups_write(&rollups, records, tags, num_records)) {
+            printf("Could not save %s\n", g_journal.rollups_path);
+        }
+        record_columns_free(&columns);
+        rollup_table_free(&rollups);
+    }
+    free(records);
+    free(tags);
+
+    // The snapshot now holds everything up to folded_bytes. Replaying those
+    // entries again is harmless, so a failure from here on loses nothing.
+    if (ok) {
+        SDL_LockMutex(g_journal.mutex);
+        fflush(g_journal.fd);
+
+        machine_path(tmp_path, MAX_PATH, ".jnl.tmp");
+        FILE* from = fopen(g_journal.journal_path, "rb");
+        FILE* to = fopen(tmp_path, "wb");
+        int64 num_entries = 0;
+        ok = from && to && journal_write_header(to);
+        if (ok) {
+            fseek(from, (long)folded_bytes, SEEK_SET);
+            JournalEntry entry;
+            while (fread(&entry, sizeof(entry), 1, from) == 1) {
+                fwrite(&entry, sizeof(entry), 1, to);
+                ++num_entries;
             }
-            else if (errno != EINTR)
-            {
-                goto out_error;
+            flush_to_disk(to);
+        }
+        if (from) {
+            fclose(from);
+        }
+        if (to) {
+            fclose(to);
+        }
+        if (ok) {
+            fclose(g_journal.fd);
+            ok = replace_file(tmp_path, g_journal.journal_path);
+            g_journal.fd = fopen(g_journal.journal_path, "ab");
+            if (ok) {
+                g_journal.num_entries = num_entries;
             }
-        } while (nread > 0);
+        }
+        SDL_UnlockMutex(g_journal.mutex);
     }
+    return ok;
+}
 
-    if (nread == 0)
-    {
-        if (close(fd_to) < 0)
-        {
-            fd_to = -1;
-            goto out_error;
+// Adds a backup point with everything that is on disk now: the snapshot with
+// the journal folded in, as restoring it should give.
+static bool32
+journal_back_up() {
+    int64 num_records = 0;
+    TimeRecord* records = NULL;
+    uint16* tags = NULL;
+    bool32 ok = journal_read_history(journal_flushed_bytes(), &records, &tags, &num_records);
+
+    // Chunked from a file of its own. It is only read back right away, so it
+    // is never synced.
+    char tmp_path[MAX_PATH];
+    machine_path(tmp_path, MAX_PATH, ".dat.backup");
+    if (ok) {
+        FILE* fd = fopen(tmp_path, "wb");
+        ok = fd && snapshot_write(fd, records, tags, num_records);
+        if (fd) {
+            ok = fclose(fd) == 0 && ok;
         }
-        close(fd_from);
+    }
+    free(records);
+    free(tags);
 
-        /* Success! */
-        return 0;
+    char backup_dir[MAX_PATH];
+    machine_path(backup_dir, MAX_PATH, "_backups");
+    int64 now = (int64)time(NULL);
+    ok = ok && backup_take(backup_dir, tmp_path, now);
+    remove(tmp_path);
+    if (ok) {
+        backup_apply_retention(backup_dir, now);
+    }
+    return ok;
+}
+
+static int
+journal_maintain(void*) {
+    if (g_journal.compact && !journal_compact()) {
+        printf("Journal compaction failed.\n");
+    }
+    if (g_journal.back_up) {
+        if (!journal_back_up()) {
+            printf("Could not back up %s\n", g_journal.data_path);
+        }
+        // After a failure, the next try is an interval later too.
+        SDL_LockMutex(g_journal.mutex);
+        g_journal.last_backup = (int64)time(NULL);
+        SDL_UnlockMutex(g_journal.mutex);
+    }
+    SDL_AtomicSet(&g_journal.busy, 0);
+    return 0;
+}
+
+// Starts the maintenance thread if the journal got long or the newest
+// backup point is older than BACKUP_INTERVAL, or if forced to. Does nothing
+// while it is still busy with the last jobs.
+static void
+journal_maybe_maintain(bool32 force_compact, bool32 force_backup) {
+    SDL_LockMutex(g_journal.mutex);
+    bool32 too_long = g_journal.num_entries >= JOURNAL_COMPACT_THRESHOLD;
+    bool32 backup_due = (int64)time(NULL) - g_journal.last_backup >= BACKUP_INTERVAL;
+    SDL_UnlockMutex(g_journal.mutex);
+    bool32 compact = too_long || force_compact;
+    bool32 back_up = backup_due || force_backup;
+
+    if ((compact || back_up) && SDL_AtomicCAS(&g_journal.busy, 0, 1)) {
+        if (g_journal.maintenance_thread) {
+            SDL_WaitThread(g_journal.maintenance_thread, NULL);
+        }
+        g_journal.compact = compact;
+        g_journal.back_up = back_up;
+        g_journal.maintenance_thread = SDL_CreateThread(journal_maintain, "solanum_maintain", NULL);
+        if (!g_journal.maintenance_thread) {
+            SDL_AtomicSet(&g_journal.busy, 0);
+        }
+    }
+}
+
+// Reads the snapshot and replays the journal on top of it. Leaves the journal
+// open for appending, with any torn tail cut off, unless read_only is set.
+// A read-only load on a machine that hasn't adopted the shared files yet
+// reads those in place.
+static bool32
+journal_load(TimerState* state, bool32 read_only) {
+    machine_path(g_journal.data_path, MAX_PATH, ".dat");
+    machine_path(g_journal.journal_path, MAX_PATH, ".jnl");
+    machine_path(g_journal.tags_path, MAX_PATH, ".tags");
+    machine_path(g_journal.rollups_path, MAX_PATH, ".rollups");
+    if (read_only && !machine_has_own_files()) {
+        path_at_exe(g_journal.data_path, MAX_PATH, "solanum.dat");
+        path_at_exe(g_journal.journal_path, MAX_PATH, "solanum.jnl");
+        path_at_exe(g_journal.tags_path, MAX_PATH, "solanum.tags");
+    }
+    g_journal.mutex = SDL_CreateMutex();
+
+    FILE* tags_fd = fopen(g_journal.tags_path, "rb");
+    if (tags_fd) {
+        if (!tags_read_names(tags_fd, &state->tags.table)) {
+            printf("%s is damaged. Projects will show without names.\n", g_journal.tags_path);
+        }
+        fclose(tags_fd);
+    }
+
+    SnapshotInfo info;
+    if (!record_store_open(&g_record_store, state, g_journal.data_path, &info)) {
+        printf("Out of memory reading %s\n", g_journal.data_path);
+        return false;
+    }
+    if (info.status == SnapshotStatus_CORRUPT) {
+        printf("%s is corrupt. Restore it from a backup.\n", g_journal.data_path);
+        return false;
+    }
+    bool32 truncated = info.status == SnapshotStatus_TRUNCATED;
+    if (truncated) {
+        printf("%s is truncated. Recovered %lld of %lld records.\n", g_journal.data_path,
+               (long long)info.num_valid, (long long)info.num_records);
+    }
+
+    FILE* fd = fopen(g_journal.journal_path, read_only ? "rb" : "r+b");
+    bool32 recovered = false;
+    if (fd) {
+        fseek(fd, 0, SEEK_END);
+        int64 file_size = (int64)ftell(fd);
+        fseek(fd, 0, SEEK_SET);
+        // Every entry could be an append.
+        size_t max_records = (size_t)state->num_records + (size_t)(file_size / (int64)sizeof(JournalEntry));
+        if (!record_store_grow(&g_record_store, state, max_records) ||
+            !tags_reserve(&state->tags, (int64)state->records_size)) {
+            printf("Out of memory replaying %s\n", g_journal.journal_path);
+            fclose(fd);
+            return false;
+        }
+        // Entries past the records the snapshot lost can't be placed, so
+        // replay stops at the first of them.
+        int64 valid_bytes = journal_replay(fd, file_size,
+                                           state->records, state->tags.record_tags, state->records_size,
+                                           &state->num_records, &g_journal.num_entries, truncated);
+        if (valid_bytes < 0) {
+            printf("%s doesn't match %s. Restore them from a backup.\n",
+                   g_journal.journal_path, g_journal.data_path);
+            fclose(fd);
+            return false;
+        }
+        if (valid_bytes == 0 && file_size >= (int64)sizeof(JournalHeader)) {
+            // Not a journal we understand. Don't touch it.
+            printf("%s is not a journal this version can read.\n", g_journal.journal_path);
+            fclose(fd);
+            return false;
+        }
+        int64 num_dropped = (file_size - valid_bytes) / (int64)sizeof(JournalEntry);
+        if (truncated && num_dropped) {
+            printf("Dropped %lld journal entries that build on the lost records.\n", (long long)num_dropped);
+        }
+        if (read_only) {
+            fclose(fd);
+            return true;
+        }
+        if (truncated && num_dropped) {
+            // Keep the whole journal before cutting it, and fold what we
+            // recovered into a complete snapshot right away.
+            char aside_path[MAX_PATH];
+            machine_path(aside_path, MAX_PATH, ".jnl.before_recovery");
+            size_t size = 0;
+            fflush(fd);
+            uint8* data = backup_read_file(g_journal.journal_path, &size);
+            if (!data || !backup_write_file(aside_path, NULL, 0, data, size)) {
+                printf("Could not copy %s aside. Not recovering.\n", g_journal.journal_path);
+                free(data);
+                fclose(fd);
+                return false;
+            }
+            free(data);
+            printf("The whole journal is in %s\n", aside_path);
+            recovered = true;
+        }
+        if (valid_bytes < file_size) {
+            truncate_file(fd, valid_bytes);
+        }
+        // Also brings a v1 header up to the version we append.
+        fseek(fd, 0, SEEK_SET);
+        journal_write_header(fd);
+        fseek(fd, 0, SEEK_END);
+    }
+    else if (read_only) {
+        return true;
+    }
+    else {
+        fd = fopen(g_journal.journal_path, "w+b");
+        if (!fd) {
+            printf("Could not create %s\n", g_journal.journal_path);
+            return false;
+        }
+        journal_write_header(fd);
+        flush_to_disk(fd);
+        flush_directory(g_journal.journal_path);
+    }
+    flush_to_disk(fd);
+    g_journal.fd = fd;
+
+    // A backup point per session, and a whole snapshot again after recovery.
+    BackupList backups;
+    char backup_dir[MAX_PATH];
+    machine_path(backup_dir, MAX_PATH, "_backups");
+    backup_list(backup_dir, &backups);
+    g_journal.last_backup = backups.count ? backups.timestamps[0] : 0;
+    free(backups.timestamps);
+    journal_maybe_maintain(recovered || truncated, true);
+    return true;
+}
+
+// Reads the rollup tables saved with the records, or builds them if they
+// don't match. Call after journal_load.
+static void
+rollups_load(TimerState* state) {
+    FILE* fd = fopen(g_journal.rollups_path, "rb");
+    bool32 ok = fd && rollup_table_read(fd, &state->rollups, state->records, state->tags.record_tags,
+                                        state->num_records);
+    if (fd) {
+        fclose(fd);
+    }
+    if (!ok) {
+        rollup_table_build(&state->rollups, &state->columns, state->records, state->tags.record_tags,
+                           state->num_records);
+    }
+}
+
+// On exit, after the maintenance thread is done. The file only counts this
+// machine's records; the others are merged in again on load.
+static void
+rollups_save(TimerState* state) {
+    history_merge_apply(&state->peers, &state->rollups, 0, state->peers.num_records, -1);
+    bool32 ok = rollups_write(&state->rollups, state->records, state->tags.record_tags, state->num_records);
+    history_merge_apply(&state->peers, &state->rollups, 0, state->peers.num_records, 1);
+    if (!ok) {
+        printf("Could not save %s\n", g_journal.rollups_path);
+    }
+}
+
+// Reads what the other machines wrote since the last look and merges it into
+// the view. Call after rollups_load.
+static void
+peers_refresh(TimerState* state) {
+    char dir[MAX_PATH];
+    path_at_exe(dir, MAX_PATH, "");
+    peers_scan(&state->peers, dir, g_machine);
+    record_merge_peers(state);
+}
+
+// Watches the data directory for the other machines' files changing, so the
+// merged view follows them while we run. The UI thread sleeps in
+// SDL_WaitEvent and is only woken, by a PEER_EVENT_CODE user event, when one
+// of their files did change; it then reads just what is new (see peers.h).
+//
+// On Linux the watcher thread blocks on inotify. Elsewhere it compares
+// peers_signature every PEER_POLL_MS, on its own thread, not the UI's.
+#define PEER_EVENT_CODE 1
+#define PEER_SETTLE_MS 250  // Quiet time we wait for, so a sync of .dat and .jnl is read once.
+#define PEER_POLL_MS 5000
+
+struct PeerWatcher {
+    char dir[MAX_PATH];
+    SDL_Thread* thread;
+    SDL_atomic_t pending;   // An event is on its way to the UI thread.
+    SDL_atomic_t quitting;
+    SDL_sem* wake;          // Posted to stop the polling thread.
+#if defined(__linux__)
+    int inotify_fd;
+    int quit_pipe[2];       // Written to stop the inotify thread.
+#endif
+};
+
+static PeerWatcher g_watcher;
+
+static void
+peer_watcher_notify() {
+    if (SDL_AtomicCAS(&g_watcher.pending, 0, 1)) {
+        SDL_Event event = {};
+        event.type = SDL_USEREVENT;
+        event.user.code = PEER_EVENT_CODE;
+        SDL_PushEvent(&event);
+    }
+}
+
+static int
+peer_watcher_poll_main(void*) {
+    uint64 signature = peers_signature(g_watcher.dir, g_machine);
+    while (SDL_SemWaitTimeout(g_watcher.wake, PEER_POLL_MS) != 0 && !SDL_AtomicGet(&g_watcher.quitting)) {
+        uint64 now = peers_signature(g_watcher.dir, g_machine);
+        if (now != signature) {
+            signature = now;
+            peer_watcher_notify();
+        }
+    }
+    return 0;
+}
+
+#if defined(__linux__)
+// Reads the pending inotify events. Returns true if one was about another
+// machine's file; ours change on every save.
+static bool32
+peer_watcher_read_events() {
+    alignas(struct inotify_event) char buffer[4096];
+    bool32 peer_changed = false;
+    ssize_t size;
+    while ((size = read(g_watcher.inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char* at = buffer; at < buffer + size;) {
+            struct inotify_event* event = (struct inotify_event*)at;
+            char machine[MERGE_NAME_SIZE];
+            if ((event->mask & IN_Q_OVERFLOW) ||
+                (event->len && peers_machine_of(event->name, machine) && strcmp(machine, g_machine) != 0)) {
+                peer_changed = true;
+            }
+            at += sizeof(struct inotify_event) + event->len;
+        }
     }
+    return peer_changed;
+}
 
-out_error:
-    saved_errno = errno;
+static int
+peer_watcher_inotify_main(void*) {
+    struct pollfd fds[2] = {};
+    fds[0].fd = g_watcher.inotify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = g_watcher.quit_pipe[0];
+    fds[1].events = POLLIN;
+    bool32 changed = false;
+    for (;;) {
+        // Block until something happens, then, once something did, until
+        // things have been quiet for PEER_SETTLE_MS.
+        int ready = poll(fds, 2, changed ? PEER_SETTLE_MS : -1);
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+        if (ready == 0) {
+            peer_watcher_notify();
+            changed = false;
+        }
+        else if (ready > 0 && fds[0].revents) {
+            changed = peer_watcher_read_events() || changed;
+        }
+    }
+    return 0;
+}
+#endif
 
-    close(fd_from);
-    if (fd_to >= 0)
-        close(fd_to);
+// Watches the directory of the data files. Falls back to polling where
+// inotify is missing or refuses.
+static void
+peer_watcher_start() {
+    path_at_exe(g_watcher.dir, MAX_PATH, "");
+#if defined(__linux__)
+    g_watcher.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (g_watcher.inotify_fd >= 0 &&
+        inotify_add_watch(g_watcher.inotify_fd, g_watcher.dir,
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) >= 0 &&
+        pipe(g_watcher.quit_pipe) == 0) {
+        g_watcher.thread = SDL_CreateThread(peer_watcher_inotify_main, "solanum_watch", NULL);
+        if (g_watcher.thread) {
+            return;
+        }
+    }
+    printf("Could not watch %s with inotify. Polling it instead.\n", g_watcher.dir);
+#endif
+    g_watcher.wake = SDL_CreateSemaphore(0);
+    if (g_watcher.wake) {
+        g_watcher.thread = SDL_CreateThread(peer_watcher_poll_main, "solanum_watch", NULL);
+    }
+}
 
-    errno = saved_errno;
-    return -1;
+static void
+peer_watcher_stop() {
+    if (!g_watcher.thread) {
+        return;
+    }
+    SDL_AtomicSet(&g_watcher.quitting, 1);
+    if (g_watcher.wake) {
+        SDL_SemPost(g_watcher.wake);
+    }
+#if defined(__linux__)
+    else if (write(g_watcher.quit_pipe[1], "q", 1) != 1) {
+        // Nothing else wakes the thread. Leave it to exit with the process.
+        return;
+    }
 #endif
+    SDL_WaitThread(g_watcher.thread, NULL);
+    g_watcher.thread = NULL;
 }
 
+// How long the I/O thread waits after being woken before it writes, so a
+// burst of edits goes out as one write and one fsync.
+#define IO_COALESCE_MS 50
+#define IO_RETRY_MS 5000
+#define IO_MAX_BATCH 256
+
+// Writes journal entries and project names handed over by the UI thread, so
+// a slow or locked disk never stalls a frame.
+//
+// Entries go through the lock-free ring. When a disk has been failing long
+// enough to fill it, they queue up behind it in the overflow array instead,
+// and keep doing so until the I/O thread has written the overflow out, so
+// they reach the journal in order.
+struct IoWorker {
+    IoQueue queue;
+    SDL_sem* wake;
+    SDL_Thread* thread;
+    SDL_atomic_t quitting;
+    SDL_atomic_t failed;
+
+    SDL_mutex* mutex;  // Guards everything below.
+    JournalEntry* overflow;
+    int num_overflow;
+    int overflow_capacity;
+    // A copy of the name table still to be written to solanum.tags. Only the
+    // newest one matters.
+    char* tag_names;
+    int64 tag_names_size;
+    int num_tags;
+    bool32 tag_names_pending;
+};
+
+static IoWorker g_io;
+
+// Appends entries to the journal and syncs it. A write that fails halfway is
+// cut off again so it can be retried without leaving a torn entry behind.
+static bool32
+io_write_entries(JournalEntry* entries, int num_entries) {
+    SDL_LockMutex(g_journal.mutex);
+    bool32 ok = false;
+    if (g_journal.fd) {
+        fseek(g_journal.fd, 0, SEEK_END);
+        int64 size = (int64)ftell(g_journal.fd);
+        ok = journal_write_entries(g_journal.fd, entries, num_entries) && flush_to_disk(g_journal.fd);
+        if (ok) {
+            g_journal.num_entries += num_entries;
+        }
+        else {
+            truncate_file(g_journal.fd, size);
+            fseek(g_journal.fd, 0, SEEK_END);
+        }
+    }
+    SDL_UnlockMutex(g_journal.mutex);
+    return ok;
+}
+
+// Writes out the newest name table the UI thread handed over, if any. Runs
+// before the entries queued with it, so a tag never reaches the journal
+// ahead of its name.
+static bool32
+io_write_tag_names() {
+    SDL_LockMutex(g_io.mutex);
+    TagTable table = {};
+    bool32 pending = g_io.tag_names_pending;
+    if (pending) {
+        table.strings = g_io.tag_names;
+        table.strings_size = g_io.tag_names_size;
+        table.num_tags = g_io.num_tags;
+        g_io.tag_names = NULL;
+        g_io.tag_names_pending = false;
+    }
+    SDL_UnlockMutex(g_io.mutex);
+    if (!pending) {
+        return true;
+    }
+
+    char tmp_path[MAX_PATH];
+    bool32 ok = backup_path_fits(snprintf(tmp_path, MAX_PATH, "%s.tmp", g_journal.tags_path));
+    FILE* fd = ok ? fopen(tmp_path, "wb") : NULL;
+    ok = fd && tags_write_names(fd, &table);
+    if (fd) {
+        ok = flush_to_disk(fd) && ok;
+        fclose(fd);
+    }
+    ok = ok && replace_file(tmp_path, g_journal.tags_path);
+    if (ok) {
+        free(table.strings);
+        return true;
+    }
+    if (!SDL_AtomicGet(&g_io.failed)) {
+        printf("Could not save project names to %s\n", g_journal.tags_path);
+    }
+    // Retry with this table unless the UI thread has sent a newer one.
+    SDL_LockMutex(g_io.mutex);
+    if (!g_io.tag_names_pending) {
+        g_io.tag_names = table.strings;
+        g_io.tag_names_size = table.strings_size;
+        g_io.num_tags = table.num_tags;
+        g_io.tag_names_pending = true;
+        table.strings = NULL;
+    }
+    SDL_UnlockMutex(g_io.mutex);
+    free(table.strings);
+    return false;
+}
+
+// Writes out the entries that didn't fit in the ring. Only runs once the ring
+// is empty, since everything in it is older.
+static bool32
+io_write_overflow() {
+    JournalEntry batch[IO_MAX_BATCH];
+    for (;;) {
+        SDL_LockMutex(g_io.mutex);
+        int num_entries = g_io.num_overflow < IO_MAX_BATCH ? g_io.num_overflow : IO_MAX_BATCH;
+        if (num_entries) {
+            memcpy(batch, g_io.overflow, (size_t)num_entries * sizeof(JournalEntry));
+        }
+        SDL_UnlockMutex(g_io.mutex);
+        if (!num_entries) {
+            return true;
+        }
+        if (!io_write_entries(batch, num_entries)) {
+            return false;
+        }
+        // The UI thread only appends, so the first num_entries are the ones
+        // we wrote.
+        SDL_LockMutex(g_io.mutex);
+        g_io.num_overflow -= num_entries;
+        memmove(g_io.overflow, g_io.overflow + num_entries, (size_t)g_io.num_overflow * sizeof(JournalEntry));
+        SDL_UnlockMutex(g_io.mutex);
+    }
+}
+
+// Tells the UI thread something changed, so it draws a frame.
+static void
+io_notify_ui() {
+    SDL_Event event = {};
+    event.type = SDL_USEREVENT;
+    SDL_PushEvent(&event);
+}
+
+static int
+io_worker_main(void*) {
+    JournalEntry batch[IO_MAX_BATCH];
+    for (;;) {
+        bool32 failed = SDL_AtomicGet(&g_io.failed);
+        if (failed) {
+            SDL_SemWaitTimeout(g_io.wake, IO_RETRY_MS);
+        }
+        else {
+            SDL_SemWait(g_io.wake);
+        }
+        bool32 quitting = SDL_AtomicGet(&g_io.quitting);
+        if (!quitting) {
+            SDL_Delay(IO_COALESCE_MS);
+        }
+        // Soak up the wakeups for everything we are about to write.
+        while (SDL_SemTryWait(g_io.wake) == 0) {
+        }
+
+        bool32 ok = io_write_tag_names();
+        int num_entries;
+        while (ok && (num_entries = io_queue_peek(&g_io.queue, batch, IO_MAX_BATCH)) > 0) {
+            ok = io_write_entries(batch, num_entries);
+            if (ok) {
+                io_queue_pop(&g_io.queue, num_entries);
+            }
+        }
+        ok = ok && io_write_overflow();
+        if (ok) {
+            journal_maybe_maintain(false, false);
+        }
+        bool32 now_failed = !ok;
+        if (now_failed != failed) {
+            if (now_failed) {
+                printf("Could not write to %s. Retrying.\n", g_journal.journal_path);
+            }
+            SDL_AtomicSet(&g_io.failed, now_failed);
+            io_notify_ui();
+        }
+        if (quitting) {
+            if (now_failed) {
+                printf("Giving up on %s. Unsaved changes are lost.\n", g_journal.journal_path);
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+static bool32
+io_worker_start() {
+    g_io.wake = SDL_CreateSemaphore(0);
+    g_io.mutex = SDL_CreateMutex();
+    g_io.thread = g_io.wake && g_io.mutex ? SDL_CreateThread(io_worker_main, "solanum_io", NULL) : NULL;
+    return g_io.thread != NULL;
+}
+
+// Writes out whatever is still queued and stops the thread.
+static void
+io_worker_stop() {
+    if (!g_io.thread) {
+        return;
+    }
+    SDL_AtomicSet(&g_io.quitting, 1);
+    SDL_SemPost(g_io.wake);
+    SDL_WaitThread(g_io.thread, NULL);
+    g_io.thread = NULL;
+    free(g_io.overflow);
+    free(g_io.tag_names);
+}
+
+// Hands the pending entries to the I/O thread and returns right away.
 void 
 platform_save_state(TimerState* state) {
-    static int num_backups = 5;
-    static int backup_i = 0;
+    if (!state->num_pending_entries) {
+        return;
+    }
+    int num_entries = state->num_pending_entries;
+    SDL_LockMutex(g_io.mutex);
+    // Only a disk that has been failing for thousands of changes fills the
+    // ring. Anything after that waits in the overflow until it is written.
+    bool32 queued = !g_io.num_overflow &&
+                    io_queue_push(&g_io.queue, state->pending_entries, num_entries);
+    if (!queued) {
+        if (g_io.num_overflow + num_entries > g_io.overflow_capacity) {
+            int capacity = g_io.overflow_capacity ? g_io.overflow_capacity * 2 : IO_QUEUE_SIZE;
+            JournalEntry* overflow = (JournalEntry*)realloc(g_io.overflow, (size_t)capacity * sizeof(JournalEntry));
+            if (overflow) {
+                g_io.overflow = overflow;
+                g_io.overflow_capacity = capacity;
+            }
+        }
+        queued = g_io.num_overflow + num_entries <= g_io.overflow_capacity;
+        if (queued) {
+            memcpy(g_io.overflow + g_io.num_overflow, state->pending_entries,
+                   (size_t)num_entries * sizeof(JournalEntry));
+            g_io.num_overflow += num_entries;
+        }
+    }
+    SDL_UnlockMutex(g_io.mutex);
+    if (!queued) {
+        printf("Out of memory. %d changes are not saved.\n", num_entries);
+    }
+    state->num_pending_entries = 0;
+    SDL_SemPost(g_io.wake);
+}
+
+// New projects are rare, so the whole name table is copied for the I/O
+// thread each time.
+void
+platform_save_tag_names(TimerState* state) {
+    TagTable* table = &state->tags.table;
+    char* names = (char*)malloc((size_t)table->strings_size + 1);
+    if (!names) {
+        printf("Out of memory. Project names are not saved.\n");
+        return;
+    }
+    memcpy(names, table->strings, (size_t)table->strings_size);
+    SDL_LockMutex(g_io.mutex);
+    free(g_io.tag_names);
+    g_io.tag_names = names;
+    g_io.tag_names_size = table->strings_size;
+    g_io.num_tags = table->num_tags;
+    g_io.tag_names_pending = true;
+    SDL_UnlockMutex(g_io.mutex);
+    SDL_SemPost(g_io.wake);
+}
+
+bool
+platform_save_failed() {
+    return SDL_AtomicGet(&g_io.failed) != 0;
+}
+
+// solanum restore            lists backup points.
+// solanum restore <point>    puts one back as this machine's snapshot.
+static int
+run_restore(int argc, char** argv) {
+    char backup_dir[MAX_PATH];
+    machine_path(backup_dir, MAX_PATH, "_backups");
+
+    if (argc < 3) {
+        BackupList list;
+        backup_list(backup_dir, &list);
+        for (int i = 0; i < list.count; ++i) {
+            time_t timestamp = (time_t)list.timestamps[i];
+            printf("%lld  %s", (long long)list.timestamps[i], ctime(&timestamp));
+        }
+        free(list.timestamps);
+        return 0;
+    }
 
     char data_path[MAX_PATH];
-    path_at_exe(data_path, MAX_PATH, "solanum.dat");
-    char backup_path[MAX_PATH];
-    char fname[MAX_PATH];
-    sprintf(fname, "BAK%d_solanum.dat", backup_i);
-    path_at_exe(backup_path, MAX_PATH, fname);
+    char journal_path[MAX_PATH];
+    char journal_aside_path[MAX_PATH];
+    machine_path(data_path, MAX_PATH, ".dat");
+    machine_path(journal_path, MAX_PATH, ".jnl");
+    machine_path(journal_aside_path, MAX_PATH, ".jnl.before_restore");
 
-    cp(data_path, backup_path);
+    // Keep what we are about to replace. The journal belongs to the current
+    // snapshot, so it moves aside with it.
+    struct stat st;
+    if (stat(data_path, &st) == 0 && !backup_take(backup_dir, data_path, (int64)time(NULL))) {
+        printf("Could not back up %s. Not restoring.\n", data_path);
+        return EXIT_FAILURE;
+    }
+    if (stat(journal_path, &st) == 0 && !replace_file(journal_path, journal_aside_path)) {
+        printf("Could not move %s aside. Not restoring.\n", journal_path);
+        return EXIT_FAILURE;
+    }
+    int64 timestamp = (int64)strtoll(argv[2], NULL, 10);
+    if (!backup_restore(backup_dir, timestamp, data_path)) {
+        replace_file(journal_aside_path, journal_path);
+        printf("Could not restore backup point %lld.\n", (long long)timestamp);
+        return EXIT_FAILURE;
+    }
+    printf("Restored backup point %lld. The old journal is in %s\n", (long long)timestamp, journal_aside_path);
+    return 0;
+}
 
-    FILE* fd = fopen(data_path, "wb");
-    assert(fd);
-    fwrite(&state->num_records, (size_t)(sizeof(int64)), 1, fd);
-    fwrite(state->records, sizeof(TimeRecord), (size_t)state->num_records, fd);
-    fclose(fd);
+// solanum export <file>      writes this machine's history as a compact archive.
+static int
+run_export(int argc, char** argv) {
+    if (argc < 3) {
+        printf("Usage: solanum export <file>\n");
+        return EXIT_FAILURE;
+    }
+    TimerState state = {};
+    if (!journal_load(&state, true)) {
+        return EXIT_FAILURE;
+    }
+    char tmp_path[MAX_PATH];
+    snprintf(tmp_path, MAX_PATH, "%s.tmp", argv[2]);
+    FILE* fd = fopen(tmp_path, "wb");
+    bool32 ok = fd && archive_write(fd, state.records, state.num_records);
+    int64 size = 0;
+    if (fd) {
+        flush_to_disk(fd);
+        size = (int64)ftell(fd);
+        fclose(fd);
+    }
+    if (!ok || !replace_file(tmp_path, argv[2])) {
+        printf("Could not write %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    printf("Archived %lld records in %lld bytes.\n", (long long)state.num_records, (long long)size);
+    return 0;
+}
 
-    backup_i = (backup_i + 1) % num_backups;
+// solanum report            time logged per perspective, day, week and month,
+//                           by weekday, and streaks.
+// solanum status            time logged today, on one line.
+// Neither touches SDL or OpenGL, so scripts can poll them cheaply.
+static int
+run_report(int argc, char** argv) {
+    TimerState state = {};
+    if (!journal_load(&state, true)) {
+        return EXIT_FAILURE;
+    }
+    rollups_load(&state);
+    peers_refresh(&state);
+    if (state.rollups.damaged) {
+        printf("Out of memory.\n");
+        return EXIT_FAILURE;
+    }
+    int64 now = (int64)time(NULL);
+    if (!strcmp(argv[1], "status")) {
+        report_print_status(&state, now);
+        return 0;
+    }
+    report_print(&state, now);
+    return 0;
 }
 
-uint32 
-timer_callback(Uint32 interval, void *param) {
-    SDL_Event event;
-    SDL_UserEvent userevent;
+// Frames we draw after input, so ImGui can settle hover and release state.
+#define REDRAW_SETTLE_FRAMES 2
 
-    userevent.type = SDL_USEREVENT;
-    userevent.code = 0;
-    userevent.data1 = NULL;
-    userevent.data2 = NULL;
+// Milliseconds until the running timer shows the next second, rounded up so
+// we don't wake just before it.
+static int
+redraw_ms_to_next_second(TimerState* state) {
+    int64 ns = timer_ns_to_next_second(&state->timer, timer_clock_now());
+    return (int)((ns + 999999) / 1000000);
+}
 
-    event.type = SDL_USEREVENT;
-    event.user = userevent;
+// The second the timer on screen shows.
+static int64
+redraw_displayed_second(TimerState* state) {
+    return timer_displayed_ns(&state->timer, timer_clock_now()) / NS_PER_SECOND;
+}
 
-    SDL_PushEvent(&event);
-    return(interval);
+// Events that change nothing on screen.
+static bool32
+redraw_is_idle_event(SDL_Event* event) {
+    return event->type == SDL_WINDOWEVENT &&
+            (event->window.event == SDL_WINDOWEVENT_MOVED ||
+             event->window.event == SDL_WINDOWEVENT_HIDDEN ||
+             event->window.event == SDL_WINDOWEVENT_MINIMIZED);
 }
 
 #ifdef _WIN32
@@ -210,9 +1288,28 @@ WinMain(HINSTANCE hInstance,
       LPSTR     lpCmdLine,
       int       nCmdShow )
 #else
-int main()
+int main(int argc, char** argv)
 #endif
 {
+#ifdef _WIN32
+    int argc = __argc;
+    char** argv = __argv;
+#endif
+    solanum_init_kernels();
+    machine_init();
+    notify_init();
+    if (argc > 1 && !strcmp(argv[1], "restore")) {
+        machine_adopt_legacy_files();
+        return run_restore(argc, argv);
+    }
+    if (argc > 1 && !strcmp(argv[1], "export")) {
+        return run_export(argc, argv);
+    }
+    if (argc > 1 && (!strcmp(argv[1], "report") || !strcmp(argv[1], "status"))) {
+        return run_report(argc, argv);
+    }
+    machine_adopt_legacy_files();
+
     // Setup SDL
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
     {
@@ -221,7 +1318,7 @@ int main()
     }
 
     int width = 500;
-    int height = 288;
+    int height = 340;
     // Setup window
     /* SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1); */
     /* SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24); */
@@ -266,124 +1363,165 @@ int main()
 
     // Setup ImGui binding
     ImGui_ImplSDLGL3_Init();
+    profiler_init();
 
     bool show_test_window = true;
     bool show_another_window = false;
     ImVec4 clear_color = ImColor(114, 144, 154);
 
-    char data_path[MAX_PATH];
-    path_at_exe(data_path, MAX_PATH, "solanum.dat");
-
     TimerState state = {};
     {
-        state.records_size = 1024 * 1024;  // About 50 years of 25min pomodoros...
         time_t current_time;
         time(&current_time);
         state.time_persp = current_time;
-        state.records = (TimeRecord*) malloc(state.records_size * sizeof(TimeRecord));
-        if (state.records) {
-            FILE* fd = fopen(data_path, "rb");
-            if (fd) {
-                fread(&state.num_records, (size_t)(sizeof(int64)), 1, fd);
-                if ((size_t)state.num_records > state.records_size) {
-                    return EXIT_FAILURE;
-                }
-                fread(state.records, sizeof(TimeRecord), (size_t)state.num_records, fd);
-                fclose(fd);
-            }
+        if (!journal_load(&state, false)) {
+            printf("Could not load the history. Exiting.\n");
+            return EXIT_FAILURE;
         }
+        if (!io_worker_start()) {
+            printf("Could not start the I/O thread: %s\n", SDL_GetError());
+            return EXIT_FAILURE;
+        }
+        rollups_load(&state);
+        peers_refresh(&state);
+        peer_watcher_start();
     }
 
-    SDL_TimerID periodical = SDL_AddTimer(450, timer_callback, NULL);
-
+    // We only draw when something could have changed: input, the window
+    // being exposed or resized, the second shown by a running timer
+    // rolling over, or a named timer finishing. In between we sleep in
+    // SDL_WaitEvent, with a timeout up to the next of those. A hidden or
+    // minimized window isn't drawn at all, except for the frame that ends a
+    // session, and only wakes for that and for named timers.
+    int frames_to_draw = REDRAW_SETTLE_FRAMES;
+    int64 drawn_second = 0;
 
     // Main loop
     while (g_running) {
         ImGuiIO& imgui_io = ImGui::GetIO();
         if (g_alert_flag) {
-            char* title = "Timer Done";
-            char* message = "Timer Done!";
-
 #if defined(_WIN32)
-            MessageBoxA(NULL,
-                        message,
-                        title,
-                        MB_OK | MB_SYSTEMMODAL);
-#else
-            const SDL_MessageBoxButtonData buttons[] = {
-                { /* .flags, .buttonid, .text */        0, 0, "Ok" },
-                //{ SDL_MESSAGEBOX_BUTTON_RETURNKEY_DEFAULT, 1, "ok" },
-                //{ SDL_MESSAGEBOX_BUTTON_ESCAPEKEY_DEFAULT, 2, "cancel" },
-            };
-            const SDL_MessageBoxColorScheme colorScheme = {
-                { /* .colors (.r, .g, .b) */
-                    /* [SDL_MESSAGEBOX_COLOR_BACKGROUND] */
-                    { 128,   128,   128 },
-                    /* [SDL_MESSAGEBOX_COLOR_TEXT] */
-                    {   0, 0,   0 },
-                    /* [SDL_MESSAGEBOX_COLOR_BUTTON_BORDER] */
-                    { 255, 255,   0 },
-                    /* [SDL_MESSAGEBOX_COLOR_BUTTON_BACKGROUND] */
-                    {   255,   0, 255 },
-                    /* [SDL_MESSAGEBOX_COLOR_BUTTON_SELECTED] */
-                    { 255,   0, 255 }
-                }
-            };
-            const SDL_MessageBoxData messageboxdata = {
-                // Error, so we don't miss it accidentaly
-                SDL_MESSAGEBOX_ERROR, /* .flags */
-                NULL, /* .window */
-                title, /* .title */
-                message, /* .message */
-                SDL_arraysize(buttons), /* .numbuttons */
-                buttons, /* .buttons */
-                &colorScheme /* .colorScheme */
-            };
-
-            int buttonid;
-
-            if (SDL_ShowMessageBox(&messageboxdata, &buttonid) < 0) {
-                SDL_Log("error displaying message box");
-                return 1;
+            // Flash the taskbar button until the window gets focus.
+            SDL_SysWMinfo wm_info;
+            SDL_VERSION(&wm_info.version);
+            if (SDL_GetWindowWMInfo(window, &wm_info)) {
+                FLASHWINFO flash = {};
+                flash.cbSize = sizeof(flash);
+                flash.hwnd = wm_info.info.win.window;
+                flash.dwFlags = FLASHW_ALL | FLASHW_TIMERNOFG;
+                FlashWindowEx(&flash);
             }
+            MessageBeep(MB_ICONASTERISK);
 #endif
             g_alert_flag = false;
+            frames_to_draw = REDRAW_SETTLE_FRAMES;
+        }
+        bool32 hidden = (SDL_GetWindowFlags(window) & (SDL_WINDOW_HIDDEN | SDL_WINDOW_MINIMIZED)) != 0;
+        if (hidden && timer_ms_to_end(&state, timer_clock_now()) != 0) {
+            frames_to_draw = 0;
+        }
+        if (frames_to_draw > 0) {
+            --frames_to_draw;
+            {
+                int mouse_x;
+                int mouse_y;
+                SDL_GetMouseState(&mouse_x, &mouse_y);
+
+                imgui_io.MousePos = ImVec2((float)mouse_x, (float)mouse_y);
+
+                imgui_io.MouseDown[0] = (bool)(SDL_GetMouseState(NULL, NULL) & SDL_BUTTON(SDL_BUTTON_LEFT));
+                imgui_io.MouseDown[1] = (bool)(SDL_GetMouseState(NULL, NULL) & SDL_BUTTON(SDL_BUTTON_MIDDLE));
+                imgui_io.MouseDown[2] = (bool)(SDL_GetMouseState(NULL, NULL) & SDL_BUTTON(SDL_BUTTON_RIGHT));
+            }
+            profiler_begin_frame();
+            {
+                PROFILE_SCOPE(ProfileStage_NEW_FRAME);
+                int d_w, d_h;
+
+                SDL_GL_GetDrawableSize(window,
+                                       &d_w, &d_h);
+                ImGui_ImplSDLGL3_NewFrame(width, height,
+                                          d_w, d_h);
+            }
+            {
+                PROFILE_SCOPE(ProfileStage_STEP);
+                timer_step_and_render(&state);
+            }
+            profiler_draw_overlay();
+            drawn_second = redraw_displayed_second(&state);
+            // Rendering
+            {
+                PROFILE_SCOPE(ProfileStage_RENDER);
+                glViewport(0, 0, (int)ImGui::GetIO().DisplaySize.x, (int)ImGui::GetIO().DisplaySize.y);
+                glClearColor(0.0f, 0.0f, 0.0f, 1);
+                glClear(GL_COLOR_BUFFER_BIT);
+                ImGui::Render();
+            }
+            {
+                PROFILE_SCOPE(ProfileStage_SWAP);
+                SDL_GL_SwapWindow(window);
+            }
         }
+
         SDL_Event event;
-        while (SDL_PollEvent(&event)) {
+        int got_event;
+        int64 timeout_ms = named_timers_ms_to_next(&state, timer_clock_now());
+        int64 redraw_ms = -1;
+        if (hidden) {
+            redraw_ms = timer_ms_to_end(&state, timer_clock_now());
+        }
+        else if (timer_shows_clock(&state)) {
+            redraw_ms = redraw_ms_to_next_second(&state);
+        }
+        if (redraw_ms >= 0 && (timeout_ms < 0 || redraw_ms < timeout_ms)) {
+            timeout_ms = redraw_ms;
+        }
+        if (frames_to_draw > 0 || g_alert_flag || !g_running || timeout_ms == 0) {
+            got_event = SDL_PollEvent(&event);
+        }
+        else if (timeout_ms > 0) {
+            got_event = SDL_WaitEventTimeout(&event, (int)timeout_ms);
+        }
+        else {
+            got_event = SDL_WaitEvent(&event);
+        }
+        while (got_event) {
             //ImGui_ImplSDLGL3_KeyCallback_ProcessEvent(&event);
             if (event.type == SDL_QUIT) {
                 g_running = false;
             }
+            if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F3 && !event.key.repeat) {
+                profiler_toggle();
+            }
+            if (event.type == SDL_USEREVENT && event.user.code == PEER_EVENT_CODE) {
+                // Changes from here on need another event.
+                SDL_AtomicSet(&g_watcher.pending, 0);
+                peers_refresh(&state);
+            }
+            if (!redraw_is_idle_event(&event)) {
+                frames_to_draw = REDRAW_SETTLE_FRAMES;
+            }
+            got_event = SDL_PollEvent(&event);
         }
-        {
-            int mouse_x;
-            int mouse_y;
-            SDL_GetMouseState(&mouse_x, &mouse_y);
-
-            imgui_io.MousePos = ImVec2((float)mouse_x, (float)mouse_y);
-
-            imgui_io.MouseDown[0] = (bool)(SDL_GetMouseState(NULL, NULL) & SDL_BUTTON(SDL_BUTTON_LEFT));
-            imgui_io.MouseDown[1] = (bool)(SDL_GetMouseState(NULL, NULL) & SDL_BUTTON(SDL_BUTTON_MIDDLE));
-            imgui_io.MouseDown[2] = (bool)(SDL_GetMouseState(NULL, NULL) & SDL_BUTTON(SDL_BUTTON_RIGHT));
+        if (frames_to_draw == 0 &&
+            (hidden ? timer_ms_to_end(&state, timer_clock_now()) == 0
+                    : timer_shows_clock(&state) && redraw_displayed_second(&state) != drawn_second)) {
+            frames_to_draw = 1;
+        }
+        // Most wakeups for the wheel only move a slot down a level. Only a
+        // timer finishing changes the screen.
+        if (named_timers_ms_to_next(&state, timer_clock_now()) == 0 && named_timers_update(&state, timer_clock_now())) {
+            frames_to_draw = REDRAW_SETTLE_FRAMES;
         }
-        int d_w, d_h;
-
-        SDL_GL_GetDrawableSize(window,
-                               &d_w, &d_h);
-        ImGui_ImplSDLGL3_NewFrame(width, height,
-                                  d_w, d_h);
-        timer_step_and_render(&state);
-        // Rendering
-        glViewport(0, 0, (int)ImGui::GetIO().DisplaySize.x, (int)ImGui::GetIO().DisplaySize.y);
-        glClearColor(0.0f, 0.0f, 0.0f, 1);
-        glClear(GL_COLOR_BUFFER_BIT);
-        ImGui::Render();
-        SDL_GL_SwapWindow(window);
-        SDL_WaitEvent(NULL);
     }
 
     // Cleanup
+    peer_watcher_stop();
+    io_worker_stop();
+    if (g_journal.maintenance_thread) {
+        SDL_WaitThread(g_journal.maintenance_thread, NULL);
+    }
+    rollups_save(&state);
     ImGui_ImplSDLGL3_Shutdown();
     SDL_DestroyWindow(window);
     SDL_Quit();
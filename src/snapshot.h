@@ -0,0 +1,248 @@
+// snapshot.h
+//
+// solanum.dat holds the whole record history as of the last compaction.
+//
+// v1: int64 count, then count packed TimeRecords. No integrity check at all.
+//
+// v2:
+//   SnapshotHeader
+//   uint32 block_crcs[num_blocks]
+//   TimeRecord records[num_records]
+//
+// Every SNAPSHOT_RECORDS_PER_BLOCK records are covered by one CRC32C and the
+// header carries its own. Records come last, so a file that was cut off still
+// has its checksums and loses only the blocks past the cut, while a bad
+// checksum on data that is present means the file is corrupt.
+//
+// v3 is v2 with the tag of each record (see tags.h) between the block
+// checksums and the records, checked by tags_crc in the header:
+//   SnapshotHeader
+//   uint32 block_crcs[num_blocks]
+//   uint16 tags[num_records]
+//   TimeRecord records[num_records]
+//
+// We always write v3. Older files are read as they are, untagged, and
+// rewritten as v3 on the next compaction.
+
+#pragma once
+
+#define SNAPSHOT_MAGIC 0x4e4c4f53  // "SOLN"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_FIRST_CHECKED_VERSION 2  // The first with checksums.
+#define SNAPSHOT_RECORDS_PER_BLOCK 4096
+
+#define SNAPSHOT_V1_DATA_OFFSET ((int64)sizeof(int64))
+
+struct SnapshotHeader {
+    uint32 magic;
+    uint32 version;
+    int64 num_records;
+    uint32 records_per_block;
+    uint32 tags_crc;    // CRC32C of the tags. Zero before v3.
+    uint32 reserved;
+    uint32 header_crc;  // CRC32C of everything above.
+};
+
+enum SnapshotStatus {
+    SnapshotStatus_OK,
+    SnapshotStatus_TRUNCATED,  // Intact, but the end of the file is missing.
+    SnapshotStatus_CORRUPT,
+};
+
+struct SnapshotInfo {
+    uint32 version;
+    int64 data_offset;  // Byte offset of the first record.
+    int64 tags_offset;  // Byte offset of the tags, or 0 if the file has none.
+    uint32 tags_crc;
+    int64 num_records;  // What the header promises.
+    int64 num_valid;    // What is actually in the file, in whole blocks for v2.
+    SnapshotStatus status;
+};
+
+static int64
+snapshot_num_blocks(int64 num_records) {
+    return (num_records + SNAPSHOT_RECORDS_PER_BLOCK - 1) / SNAPSHOT_RECORDS_PER_BLOCK;
+}
+
+static uint32
+snapshot_header_crc(const SnapshotHeader* header) {
+    return crc32c(0, header, offsetof(SnapshotHeader, header_crc));
+}
+
+// Reads the format and sizes from the first head_size bytes of a file that is
+// file_size bytes long. An empty file is an empty v1 history.
+static void
+snapshot_parse_header(const void* head, size_t head_size, int64 file_size, SnapshotInfo* info) {
+    *info = {};
+    const SnapshotHeader* header = (const SnapshotHeader*)head;
+    if (head_size >= sizeof(SnapshotHeader) && header->magic == SNAPSHOT_MAGIC) {
+        info->version = header->version;
+        if (header->version < SNAPSHOT_FIRST_CHECKED_VERSION || header->version > SNAPSHOT_VERSION ||
+            header->header_crc != snapshot_header_crc(header) ||
+            header->records_per_block != SNAPSHOT_RECORDS_PER_BLOCK ||
+            header->num_records < 0) {
+            info->status = SnapshotStatus_CORRUPT;
+            return;
+        }
+        info->num_records = header->num_records;
+        info->data_offset = (int64)sizeof(SnapshotHeader) +
+                (int64)sizeof(uint32) * snapshot_num_blocks(header->num_records);
+        if (header->version >= 3) {
+            info->tags_offset = info->data_offset;
+            info->tags_crc = header->tags_crc;
+            info->data_offset += (int64)sizeof(uint16) * header->num_records;
+        }
+    }
+    else {
+        info->version = 1;
+        info->data_offset = SNAPSHOT_V1_DATA_OFFSET;
+        if (head_size >= sizeof(int64)) {
+            memcpy(&info->num_records, head, sizeof(int64));
+        }
+        if (info->num_records < 0) {
+            info->status = SnapshotStatus_CORRUPT;
+            return;
+        }
+    }
+
+    int64 in_file = file_size > info->data_offset ?
+            (file_size - info->data_offset) / (int64)sizeof(TimeRecord) : 0;
+    info->num_valid = info->num_records;
+    if (in_file < info->num_records) {
+        info->status = SnapshotStatus_TRUNCATED;
+        info->num_valid = in_file;
+        if (info->version >= SNAPSHOT_FIRST_CHECKED_VERSION) {
+            // The checksum of a partial block can't be checked.
+            info->num_valid -= in_file % SNAPSHOT_RECORDS_PER_BLOCK;
+        }
+    }
+}
+
+// Checks the blocks that are present. Downgrades info->status to CORRUPT on
+// the first mismatch.
+static void
+snapshot_verify(SnapshotInfo* info, const uint32* block_crcs, const TimeRecord* records) {
+    if (info->version < SNAPSHOT_FIRST_CHECKED_VERSION || info->status == SnapshotStatus_CORRUPT) {
+        return;
+    }
+    int64 num_blocks = snapshot_num_blocks(info->num_valid);
+    for (int64 block = 0; block < num_blocks; ++block) {
+        int64 first = block * SNAPSHOT_RECORDS_PER_BLOCK;
+        int64 count = info->num_valid - first;
+        if (count > SNAPSHOT_RECORDS_PER_BLOCK) {
+            count = SNAPSHOT_RECORDS_PER_BLOCK;
+        }
+        if (crc32c(0, records + first, (size_t)count * sizeof(TimeRecord)) != block_crcs[block]) {
+            info->status = SnapshotStatus_CORRUPT;
+            return;
+        }
+    }
+}
+
+// Checks the tags of all info->num_records records, which are in the file
+// whenever any record is, and copies out those of the info->num_valid loaded
+// ones. Files without tags give TAG_NONE.
+static void
+snapshot_verify_tags(SnapshotInfo* info, const uint16* all_tags, uint16* tags) {
+    if (info->status == SnapshotStatus_CORRUPT) {
+        return;
+    }
+    if (!info->tags_offset || !info->num_valid) {
+        memset(tags, 0, (size_t)info->num_valid * sizeof(uint16));
+        return;
+    }
+    if (crc32c(0, all_tags, (size_t)info->num_records * sizeof(uint16)) != info->tags_crc) {
+        info->status = SnapshotStatus_CORRUPT;
+        return;
+    }
+    memcpy(tags, all_tags, (size_t)info->num_valid * sizeof(uint16));
+}
+
+// First half of reading a snapshot through stdio: fills info so the caller
+// can make room for info->num_valid records.
+static void
+snapshot_read_info(FILE* fd, SnapshotInfo* info) {
+    fseek(fd, 0, SEEK_END);
+    int64 file_size = (int64)ftell(fd);
+    fseek(fd, 0, SEEK_SET);
+    SnapshotHeader header = {};
+    size_t head_size = fread(&header, 1, sizeof(header), fd);
+    snapshot_parse_header(&header, head_size, file_size, info);
+}
+
+// Second half: reads and verifies info->num_valid records and their tags.
+static void
+snapshot_read_records(FILE* fd, SnapshotInfo* info, TimeRecord* records, uint16* tags) {
+    if (info->status == SnapshotStatus_CORRUPT) {
+        return;
+    }
+    uint32* block_crcs = NULL;
+    if (info->version >= SNAPSHOT_FIRST_CHECKED_VERSION) {
+        size_t num_blocks = (size_t)snapshot_num_blocks(info->num_records);
+        block_crcs = (uint32*)malloc(num_blocks * sizeof(uint32) + 1);
+        fseek(fd, (long)sizeof(SnapshotHeader), SEEK_SET);
+        if (!block_crcs || fread(block_crcs, sizeof(uint32), num_blocks, fd) != num_blocks) {
+            info->status = SnapshotStatus_CORRUPT;
+            free(block_crcs);
+            return;
+        }
+    }
+    fseek(fd, (long)info->data_offset, SEEK_SET);
+    info->num_valid = (int64)fread(records, sizeof(TimeRecord), (size_t)info->num_valid, fd);
+    snapshot_verify(info, block_crcs, records);
+    free(block_crcs);
+
+    uint16* all_tags = NULL;
+    if (info->tags_offset && info->num_valid) {
+        all_tags = (uint16*)malloc((size_t)info->num_records * sizeof(uint16));
+        fseek(fd, (long)info->tags_offset, SEEK_SET);
+        if (!all_tags || fread(all_tags, sizeof(uint16), (size_t)info->num_records, fd) != (size_t)info->num_records) {
+            info->status = SnapshotStatus_CORRUPT;
+            free(all_tags);
+            return;
+        }
+    }
+    snapshot_verify_tags(info, all_tags, tags);
+    free(all_tags);
+}
+
+static bool32
+snapshot_write(FILE* fd, TimeRecord* records, uint16* tags, int64 num_records) {
+    SnapshotHeader header = {};
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.num_records = num_records;
+    header.records_per_block = SNAPSHOT_RECORDS_PER_BLOCK;
+    header.tags_crc = crc32c(0, tags, (size_t)num_records * sizeof(uint16));
+    header.header_crc = snapshot_header_crc(&header);
+
+    size_t num_blocks = (size_t)snapshot_num_blocks(num_records);
+    uint32* block_crcs = (uint32*)malloc(num_blocks * sizeof(uint32) + 1);
+    if (!block_crcs) {
+        return false;
+    }
+    for (size_t block = 0; block < num_blocks; ++block) {
+        int64 first = (int64)block * SNAPSHOT_RECORDS_PER_BLOCK;
+        int64 count = num_records - first;
+        if (count > SNAPSHOT_RECORDS_PER_BLOCK) {
+            count = SNAPSHOT_RECORDS_PER_BLOCK;
+        }
+        block_crcs[block] = crc32c(0, records + first, (size_t)count * sizeof(TimeRecord));
+    }
+    bool32 ok = fwrite(&header, sizeof(header), 1, fd) == 1 &&
+                fwrite(block_crcs, sizeof(uint32), num_blocks, fd) == num_blocks &&
+                fwrite(tags, sizeof(uint16), (size_t)num_records, fd) == (size_t)num_records &&
+                fwrite(records, sizeof(TimeRecord), (size_t)num_records, fd) == (size_t)num_records;
+    free(block_crcs);
+    return ok;
+}
+
+static const char*
+snapshot_status_string(SnapshotStatus status) {
+    switch (status) {
+        case SnapshotStatus_OK: return "ok";
+        case SnapshotStatus_TRUNCATED: return "truncated";
+        case SnapshotStatus_CORRUPT: return "corrupt";
+    }
+    return "unknown";
+}
@@ -4,6 +4,7 @@
 #include <stdio.h>
 
 typedef int32_t bool32;
+typedef uint8_t uint8;
 typedef int16_t int16;
 typedef uint16_t uint16;
 typedef int32_t int32;
@@ -37,8 +38,79 @@ struct TimeRecord {
     int16 elapsed;
     int64 timestamp;
 };
+
+// Record changes are persisted as journal entries instead of rewriting the
+// whole history. Indices are absolute, so replaying a journal over a snapshot
+// that already folded some of its entries gives the same result.
+enum RecordOp {
+    RecordOp_APPEND = 1,
+    RecordOp_EDIT,
+    RecordOp_TRUNCATE,
+    RecordOp_TAG,  // Sets the tag of the record at index.
+};
+
+struct JournalEntry {
+    uint8 op;
+    int64 index;
+    union {
+        TimeRecord record;
+        uint16 tag;
+    };
+    uint32 checksum;
+};
 #pragma pack(pop)
 
+#define MAX_PENDING_ENTRIES 16
+
+// The tag of the records named timers log. What they time, a meeting or the
+// tea, is not focus time, so the index, the columns, the rollup tables and
+// the merge with other machines all leave these records out. Interned tags
+// stop below it (see tags.h).
+#define TAG_TIMER 0xffff
+
+// Whether records[record_id] counts as focus time. tags is the tag column,
+// or NULL to count every record.
+static bool32
+record_is_focus(const uint16* tags, int64 record_id) {
+    return !tags || tags[record_id] != TAG_TIMER;
+}
+
+#include "crc32c.h"
+#include "record_index.h"
+#include "record_columns.h"
+#include "day_table.h"
+#include "rollup_table.h"
+#include "history_merge.h"
+#include "tags.h"
+#include "timer.h"
+#include "timer_wheel.h"
+#include "heatmap.h"
+
+// Picks the CPU-specific kernels. The first thing main does, before any thread
+// starts, since the picks are plain globals read without locking.
+static void
+solanum_init_kernels() {
+    crc32c_init();
+    record_columns_init();
+}
+
+#define MAX_NAMED_TIMERS TIMER_WHEEL_MAX_ID
+#define NAMED_TIMER_NAME_SIZE 32
+#define NAMED_TIMER_MAX_MINUTES 540  // TimeRecord::elapsed is an int16 of seconds.
+#define NS_PER_MS ((int64)1000 * 1000)
+
+// How often to ask whether the time zone changed under the day table.
+#define ZONE_CHECK_SECONDS 60
+
+// A countdown the user names and runs next to the pomodoro: a meeting, the
+// tea. A slot is free while its timer is stopped.
+struct NamedTimer {
+    char name[NAMED_TIMER_NAME_SIZE];
+    Timer timer;
+    int64 duration_ns;
+    char done_at[16];  // Local time it should finish, formatted when scheduled.
+};
+
 enum TimerType {
     TimerType_POMODORO,
     TimerType_SHORT_BREAK,
@@ -52,20 +124,49 @@ struct TimerState {
     TimeRecord* records;
     size_t records_size;
     int64 num_records;
+    RecordIndex index;
+    RecordColumns columns;
+    RollupTable rollups;
+    int64 zone_checked_at;
+    HistoryMerge peers;  // The other machines' records, filled by the platform.
+    Tags tags;
+
+    // Changes not yet handed to platform_save_state.
+    JournalEntry pending_entries[MAX_PENDING_ENTRIES];
+    int num_pending_entries;
 
     int num_seconds;
 
     int num_pomodoros;
 
-    time_t begin_time;
-    bool32 started;
+    Timer timer;
     TimerType timer_type;
 
-    time_t pause_time;
-    int16 pause_elapsed;
-    bool32 paused;
-
+    // Named timer i has id i + 1 in the wheel, which holds the deadlines of
+    // the running ones in milliseconds of awake time.
+    NamedTimer named_timers[MAX_NAMED_TIMERS];
+    TimerWheel wheel;
+    int64 named_asleep_ns;  // asleep_ns as of the last sleep check.
+    char new_timer_name[NAMED_TIMER_NAME_SIZE];
+    int new_timer_minutes;
+    bool32 named_timers_full;  // "Start timer" found no free slot. Cleared when one frees up.
+
+    // The "timer done" toast. It stays up until dismissed or until the next
+    // pomodoro starts. finished_name is set when a named timer finished.
+    bool32 show_finished;
+    TimerType finished_type;
+    char finished_name[NAMED_TIMER_NAME_SIZE];
+
+    // The edit screen works on a copy, which only goes into the records, and
+    // the journal, on "Finish". A named timer may log a record meanwhile, so
+    // the entry is remembered by position.
     bool32 editing_last_entry;
+    int64 editing_index;
+    TimeRecord editing_record;
+
+    char project[TAG_NAME_SIZE];  // Tag for the pomodoros from here on.
+
+    Heatmap heatmap;
 
     int64 time_persp;  // Point of reference for timer quick report
     char* curr_phrase;
@@ -76,6 +177,117 @@ static char* phrases[] = {
     "",
 };
 
+static void
+record_log(TimerState* state, RecordOp op, int64 index) {
+    if (state->num_pending_entries == MAX_PENDING_ENTRIES) {
+        platform_save_state(state);
+    }
+    JournalEntry* entry = &state->pending_entries[state->num_pending_entries++];
+    *entry = {};
+    entry->op = (uint8)op;
+    entry->index = index;
+    if (op == RecordOp_TAG) {
+        entry->tag = state->tags.record_tags[index];
+    }
+    else if (op != RecordOp_TRUNCATE) {
+        entry->record = state->records[index];
+    }
+}
+
+// Time logged since the perspective, on every machine.
+static int64
+record_seconds_since_persp(TimerState* state) {
+    return record_index_seconds_since(&state->index, state->records, state->tags.record_tags, state->num_records,
+                                      state->time_persp) +
+            history_merge_seconds_since(&state->peers, state->time_persp);
+}
+
+// Merges what the other machines logged since the last call, after the
+// platform read their files into state->peers, or after a change of ours
+// left the view stale.
+static void
+record_merge_peers(TimerState* state) {
+    if (history_merge_update(&state->peers, &state->index, state->records, state->tags.record_tags,
+                             state->num_records, &state->rollups)) {
+        state->num_seconds = (int)record_seconds_since_persp(state);
+    }
+}
+
+static void
+record_append(TimerState* state, TimeRecord record, uint16 tag) {
+    if (((size_t)state->num_records >= state->records_size && !platform_grow_records(state)) ||
+        !tags_reserve(&state->tags, state->num_records + 1)) {
+        printf("Out of memory. Record not saved.\n");
+        return;
+    }
+    int64 index = state->num_records++;
+    state->records[index] = record;
+    tags_on_append(&state->tags, index);
+    if (tag != TAG_NONE) {
+        tags_set(&state->tags, state->records, index, tag);
+    }
+    bool32 focus = record_is_focus(state->tags.record_tags, index);
+    if (focus) {
+        record_index_on_append(&state->index, state->records, index);
+        rollup_table_apply(&state->rollups, record, 1);
+    }
+    record_columns_on_append(&state->columns, state->records, state->tags.record_tags, index);
+    record_log(state, RecordOp_APPEND, index);
+    if (tag != TAG_NONE) {
+        record_log(state, RecordOp_TAG, index);
+    }
+    // Another machine logged the same session first. Ours wins.
+    if (focus && history_merge_has(&state->peers, record)) {
+        state->peers.stale = true;
+        record_merge_peers(state);
+    }
+}
+
+// Called after records[index] was changed in place. old_record is what it
+// was before.
+static void
+record_edit(TimerState* state, int64 index, TimeRecord old_record) {
+    if (record_is_focus(state->tags.record_tags, index)) {
+        record_index_on_edit(&state->index, state->records, index);
+        rollup_table_on_edit(&state->rollups, old_record, state->records[index]);
+    }
+    record_columns_on_edit(&state->columns, state->records, state->tags.record_tags, index);
+    tags_on_edit(&state->tags, state->records, index);
+    record_log(state, RecordOp_EDIT, index);
+    // The old session may have hidden another machine's copy of it, and the
+    // new one may duplicate one.
+    if (state->peers.num_sources) {
+        state->peers.stale = true;
+        record_merge_peers(state);
+    }
+}
+
+static void
+record_truncate(TimerState* state, int64 num_records) {
+    int64 old_num_records = state->num_records;
+    rollup_table_on_truncate(&state->rollups, state->records, state->tags.record_tags, old_num_records, num_records);
+    state->num_records = num_records;
+    record_index_on_truncate(&state->index, state->records, state->tags.record_tags, old_num_records, num_records);
+    record_columns_on_truncate(&state->columns, num_records);
+    tags_on_truncate(&state->tags, state->records, num_records);
+    record_log(state, RecordOp_TRUNCATE, num_records);
+    if (state->peers.num_sources) {
+        state->peers.stale = true;
+        record_merge_peers(state);
+    }
+}
+
+// The id of a project name, adding it to solanum.tags if it is new.
+static uint16
+record_tag_for(TimerState* state, const char* name) {
+    int num_tags = state->tags.table.num_tags;
+    uint16 tag = tag_table_intern(&state->tags.table, name);
+    if (state->tags.table.num_tags != num_tags) {
+        platform_save_tag_names(state);
+    }
+    return tag;
+}
+
 #define TEXT_BUFFER_SIZE 256
 static void
 format_seconds(char* buffer, char* msg, int in_seconds) {
@@ -85,11 +297,236 @@ format_seconds(char* buffer, char* msg, int in_seconds) {
     snprintf(buffer, TEXT_BUFFER_SIZE, "%s: %dh %dm %ds", msg, hours, minutes, seconds);
 }
 
+// What the "timer done" toast and the desktop notification say.
+static const char*
+timer_finished_text(TimerState* state, char* buffer) {
+    if (state->finished_name[0]) {
+        snprintf(buffer, TEXT_BUFFER_SIZE, "%s is done.", state->finished_name);
+        return buffer;
+    }
+    if (state->finished_type == TimerType_POMODORO) {
+        return "Pomodoro finished. Time for a break!";
+    }
+    return "Break is over. Back to work!";
+}
+
+static TimerClock
+timer_clock_now() {
+    TimerClock clock;
+    clock.awake_ns = platform_monotonic_ns();
+    clock.asleep_ns = platform_suspended_ns();
+    return clock;
+}
+
+static void
+pomodoro_start(TimerState* state, TimerClock clock, TimerType type) {
+    timer_start(&state->timer, clock);
+    state->timer_type = type;
+    state->show_finished = false;
+}
+
+// Puts a running named timer's deadline in the wheel.
+static void
+named_timer_schedule(TimerState* state, int index, TimerClock clock, int64 now) {
+    NamedTimer* named = &state->named_timers[index];
+    int64 left_ns = named->duration_ns - timer_elapsed_ns(&named->timer, clock);
+    timer_wheel_add(&state->wheel, index + 1, (clock.awake_ns + left_ns + NS_PER_MS - 1) / NS_PER_MS);
+    time_t done_at = (time_t)(now + (left_ns + NS_PER_SECOND - 1) / NS_PER_SECOND);
+    strftime(named->done_at, sizeof(named->done_at), "%H:%M:%S", localtime(&done_at));
+}
+
+// Returns false if every slot is taken.
+static bool32
+named_timer_start(TimerState* state, const char* name, int minutes, TimerClock clock, int64 now) {
+    for (int i = 0; i < MAX_NAMED_TIMERS; ++i) {
+        NamedTimer* named = &state->named_timers[i];
+        if (named->timer.phase == TimerPhase_STOPPED) {
+            *named = {};
+            snprintf(named->name, NAMED_TIMER_NAME_SIZE, "%s", name[0] ? name : "Timer");
+            named->duration_ns = (int64)minutes * 60 * NS_PER_SECOND;
+            timer_start(&named->timer, clock);
+            named_timer_schedule(state, i, clock, now);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+named_timer_pause(TimerState* state, int index, TimerClock clock) {
+    timer_pause(&state->named_timers[index].timer, clock);
+    timer_wheel_remove(&state->wheel, index + 1);
+}
+
+static void
+named_timer_resume(TimerState* state, int index, TimerClock clock, int64 now) {
+    timer_resume(&state->named_timers[index].timer, clock);
+    named_timer_schedule(state, index, clock, now);
+}
+
+// Logs the time the timer ran as its own record, tagged TAG_TIMER so it is
+// not counted as focus time. `finished` means it ran out rather than being
+// stopped.
+static void
+named_timer_stop(TimerState* state, int index, TimerClock clock, int64 now, bool32 finished) {
+    NamedTimer* named = &state->named_timers[index];
+    timer_wheel_remove(&state->wheel, index + 1);
+    state->named_timers_full = false;
+    int64 elapsed = timer_stop(&named->timer, clock) / NS_PER_SECOND;
+    if (elapsed > named->duration_ns / NS_PER_SECOND) {
+        elapsed = named->duration_ns / NS_PER_SECOND;
+    }
+    TimeRecord record = {};
+    record.timestamp = now;
+    record.elapsed = (int16)elapsed;
+    record_append(state, record, TAG_TIMER);
+    if (finished) {
+        char buffer[TEXT_BUFFER_SIZE];
+        state->show_finished = true;
+        snprintf(state->finished_name, NAMED_TIMER_NAME_SIZE, "%s", named->name);
+        platform_alert(timer_finished_text(state, buffer));
+    }
+    platform_save_state(state);
+}
+
+// Finishes the named timers whose time is up. Cheap enough to call every
+// frame: a sleep check over all of them only happens after the machine
+// actually slept. Returns how many finished.
+static int
+named_timers_update(TimerState* state, TimerClock clock) {
+    int64 now = (int64)time(NULL);
+    if (clock.asleep_ns - state->named_asleep_ns >= TIMER_MIN_SLEEP_NS) {
+        state->named_asleep_ns = clock.asleep_ns;
+        for (int i = 0; i < MAX_NAMED_TIMERS; ++i) {
+            if (timer_check_sleep(&state->named_timers[i].timer, clock)) {
+                timer_wheel_remove(&state->wheel, i + 1);
+            }
+        }
+    }
+    if (g_solanum_message_queue & SOLANUM_QUIT) {
+        for (int i = 0; i < MAX_NAMED_TIMERS; ++i) {
+            if (state->named_timers[i].timer.phase != TimerPhase_STOPPED) {
+                named_timer_stop(state, i, clock, now, false);
+            }
+        }
+    }
+    int expired[TIMER_WHEEL_MAX_ID];
+    int num_expired = timer_wheel_advance(&state->wheel, clock.awake_ns / NS_PER_MS, expired);
+    for (int i = 0; i < num_expired; ++i) {
+        named_timer_stop(state, expired[i] - 1, clock, now, true);
+    }
+    return num_expired;
+}
+
+// Milliseconds until the wheel has something to do, or -1 if no named timer
+// is running. Zero means named_timers_update is due.
+static int64
+named_timers_ms_to_next(TimerState* state, TimerClock clock) {
+    int64 next = timer_wheel_next_tick(&state->wheel);
+    if (next < 0) {
+        return -1;
+    }
+    int64 now_ms = clock.awake_ns / NS_PER_MS;
+    return next > now_ms ? next - now_ms : 0;
+}
+
+// Named timers show when they will be done instead of counting down, so
+// they never need a redraw of their own.
+static void
+named_timers_render(TimerState* state, TimerClock clock, int64 now) {
+    char buffer[TEXT_BUFFER_SIZE];
+    ImGui::SetNextWindowPos({420, 10}, ImGuiSetCond_FirstUseEver);
+    ImGui::Begin("Timers", NULL, ImGuiWindowFlags_AlwaysAutoResize);
+    for (int i = 0; i < MAX_NAMED_TIMERS; ++i) {
+        NamedTimer* named = &state->named_timers[i];
+        if (named->timer.phase == TimerPhase_STOPPED) {
+            continue;
+        }
+        ImGui::PushID(i);
+        if (named->timer.phase == TimerPhase_RUNNING) {
+            ImGui::Text("%s: done at %s", named->name, named->done_at);
+            ImGui::SameLine();
+            if (ImGui::Button("Pause")) {
+                named_timer_pause(state, i, clock);
+            }
+        }
+        else {
+            int64 left_ns = named->duration_ns - timer_elapsed_ns(&named->timer, clock);
+            format_seconds(buffer, named->name, (int)(left_ns / NS_PER_SECOND));
+            ImGui::Text("%s left, paused", buffer);
+            ImGui::SameLine();
+            if (ImGui::Button("Resume")) {
+                named_timer_resume(state, i, clock, now);
+            }
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Stop")) {
+            named_timer_stop(state, i, clock, now, false);
+        }
+        ImGui::PopID();
+    }
+    ImGui::Separator();
+    if (state->new_timer_minutes < 1 || state->new_timer_minutes > NAMED_TIMER_MAX_MINUTES) {
+        state->new_timer_minutes = state->new_timer_minutes < 1 ? 10 : NAMED_TIMER_MAX_MINUTES;
+    }
+    ImGui::InputText("Name", state->new_timer_name, NAMED_TIMER_NAME_SIZE);
+    ImGui::InputInt("Minutes", &state->new_timer_minutes);
+    if (ImGui::Button("Start timer")) {
+        if (named_timer_start(state, state->new_timer_name, state->new_timer_minutes, clock, now)) {
+            state->new_timer_name[0] = '\0';
+        }
+        else {
+            state->named_timers_full = true;
+        }
+    }
+    if (state->named_timers_full) {
+        ImGui::Text("All %d timers are in use. Stop one first.", MAX_NAMED_TIMERS);
+    }
+    ImGui::End();
+}
+
+// Whether the screen changes every second on its own, without input.
+static bool32
+timer_shows_clock(TimerState* state) {
+    return state->timer.phase != TimerPhase_STOPPED && !state->editing_last_entry;
+}
+
+static int16
+timer_type_seconds(TimerType type) {
+    switch (type) {
+        case TimerType_POMODORO: return MINUTES(25);
+        case TimerType_SHORT_BREAK: return MINUTES(5);
+        case TimerType_LONG_BREAK: return MINUTES(30);
+    }
+    return 0;
+}
+
+// Milliseconds until the running session is up, or -1 if none is. The frame
+// after that is the one that logs it.
+static int64
+timer_ms_to_end(TimerState* state, TimerClock clock) {
+    if (state->timer.phase != TimerPhase_RUNNING || state->editing_last_entry) {
+        return -1;
+    }
+    int64 left_ns = timer_type_seconds(state->timer_type) * NS_PER_SECOND - timer_elapsed_ns(&state->timer, clock);
+    return left_ns > 0 ? (left_ns + NS_PER_MS - 1) / NS_PER_MS : 0;
+}
+
 static void
 timer_step_and_render(TimerState* state) {
     char buffer[TEXT_BUFFER_SIZE];
     time_t current_time;
     time(&current_time);
+    TimerClock clock = timer_clock_now();
+    timer_check_sleep(&state->timer, clock);
+
+    if (current_time - state->zone_checked_at >= ZONE_CHECK_SECONDS || current_time < state->zone_checked_at) {
+        state->zone_checked_at = current_time;
+        if (rollup_table_check_zone(&state->rollups, &state->columns, state->records, state->tags.record_tags,
+                                    state->num_records)) {
+            history_merge_apply(&state->peers, &state->rollups, 0, state->peers.num_records, 1);
+        }
+    }
 
     // Old blue color
     int style_stack = 0;
@@ -97,7 +534,11 @@ timer_step_and_render(TimerState* state) {
 
     bool show_solanum = true;
     ImGui::Begin("Solanum", &show_solanum);
-    ImGui::SetWindowSize({400,200});
+    ImGui::SetWindowSize({400,250});
+
+    if (platform_save_failed()) {
+        ImGui::TextColored({1.0f, 0.4f, 0.4f, 1.0f}, "Could not save to disk. Retrying.");
+    }
 
     if (!state->curr_phrase) {
         int num_phrases = sizeof(phrases) / sizeof(char*);
@@ -114,7 +555,8 @@ timer_step_and_render(TimerState* state) {
 
     if (state->editing_last_entry) {
         bool32 save = false;
-        TimeRecord* record = &state->records[state->num_records-1];
+        TimeRecord* record = &state->editing_record;
+        int64 index = state->editing_index;
         ImGui::Text("Seconds logged: %d", record->elapsed);
         static bool32 delete_open = false;
         int nv = record->elapsed;
@@ -125,18 +567,18 @@ timer_step_and_render(TimerState* state) {
         }
         format_seconds(buffer, "Entry", nv);
         ImGui::Text(buffer);
-        if ( ImGui::Button("Delete") ) {
+        // Only the last record can be deleted.
+        if ( index == state->num_records - 1 && ImGui::Button("Delete") ) {
             delete_open = true;
         }
         if ( delete_open ) {
             ImGui::Text("Are you sure?");
             if ( ImGui::Button("Don't delete!") ) {
-                state->editing_last_entry = false;
                 delete_open = false;
                 state->editing_last_entry = false;
             }
-            if ( ImGui::Button("Yes, delete") ) {
-                --state->num_records;
+            if ( ImGui::Button("Yes, delete") && index == state->num_records - 1 ) {
+                record_truncate(state, index);
                 save = true;
                 change_persp = true;
                 delete_open = false;
@@ -144,15 +586,21 @@ timer_step_and_render(TimerState* state) {
             }
         }
         if( ImGui::Button("Finish") ) {
+            if (memcmp(record, &state->records[index], sizeof(TimeRecord)) != 0) {
+                TimeRecord old_record = state->records[index];
+                state->records[index] = *record;
+                record_edit(state, index, old_record);
+                save = true;
+            }
             state->editing_last_entry = false;
+            delete_open = false;
             change_persp = true;
-            save = true;
         }
         if ( save ) {
             platform_save_state(state);
         }
     }
-    else if (!state->started) {
+    else if (state->timer.phase == TimerPhase_STOPPED) {
         ImGui::Text("Perspective: ");
         ImGui::SameLine();
         if (ImGui::Button("Now"))
@@ -181,30 +629,26 @@ timer_step_and_render(TimerState* state) {
         ImGui::Separator();
         format_seconds(buffer, "Time logged", state->num_seconds);
         ImGui::Text(buffer);
+        ImGui::InputText("Project", state->project, TAG_NAME_SIZE);
+        uint16 project_tag = tag_table_find(&state->tags.table, state->project);
+        if (project_tag != TAG_NONE) {
+            int64 on_project = tags_seconds_between(&state->tags, state->records, state->num_records,
+                                                    project_tag, state->time_persp, INT64_MAX);
+            format_seconds(buffer, "On this project", (int)on_project);
+            ImGui::Text(buffer);
+        }
         ImGui::Spacing();
         state->timer_type = TimerType_POMODORO;
         if (ImGui::Button("Pomodoro")) {
-            state->started = true;
-            time_t begin_time;
-            time(&begin_time);
-            state->begin_time = begin_time;
-            state->timer_type = TimerType_POMODORO;
+            pomodoro_start(state, clock, TimerType_POMODORO);
         }
         ImGui::SameLine(0, 20);
         if (ImGui::Button("Short break")) {
-            state->started = true;
-            time_t begin_time;
-            time(&begin_time);
-            state->begin_time = begin_time;
-            state->timer_type = TimerType_SHORT_BREAK;
+            pomodoro_start(state, clock, TimerType_SHORT_BREAK);
         }
         ImGui::SameLine(0, 20);
         if (ImGui::Button("Long break")) {
-            state->started = true;
-            time_t begin_time;
-            time(&begin_time);
-            state->begin_time = begin_time;
-            state->timer_type = TimerType_LONG_BREAK;
+            pomodoro_start(state, clock, TimerType_LONG_BREAK);
         }
 
         ImGui::Separator();
@@ -220,58 +664,44 @@ timer_step_and_render(TimerState* state) {
         if (ImGui::Button("Quit")) {
             platform_quit();
         }
-        ImGui::SameLine(0, 150);
-        if (ImGui::Button("Edit last entry.")) {
+        ImGui::SameLine(0, 20);
+        if (ImGui::Button("Calendar")) {
+            state->heatmap.open = !state->heatmap.open;
+        }
+        ImGui::SameLine(0, 60);
+        if (ImGui::Button("Edit last entry.") && state->num_records > 0) {
             state->editing_last_entry = true;
+            state->editing_index = state->num_records - 1;
+            state->editing_record = state->records[state->editing_index];
         }
 
     }
-    else if (state->started) {
-        int16 elapsed = 0;
-        {
-            int64 elapsed_64 = current_time - state->begin_time - state->pause_elapsed;
-            if (elapsed_64 <= (1 << 15) - 1) {
-                elapsed = (int16) elapsed_64;
-            }
-            else {
-                state->started = false;
-            }
-        }
+    else {
+        int64 elapsed = timer_elapsed_ns(&state->timer, clock) / NS_PER_SECOND;
 
-        int16 time_unit_length = 0;
-        switch(state->timer_type) {
-            case TimerType_POMODORO: {
-                time_unit_length = MINUTES(25);
-            } break;
-            case TimerType_SHORT_BREAK: {
-                time_unit_length = MINUTES(5);
-            } break;
-            case TimerType_LONG_BREAK: {
-                time_unit_length = MINUTES(30);
-            } break;
-        }
+        int16 time_unit_length = timer_type_seconds(state->timer_type);
         int64 time_left = time_unit_length - elapsed;
 
-        static time_t current_time_at_pause = 0;
-        if (!state->paused) {
-            format_seconds(buffer, "Time elapsed", elapsed);
+        if (state->timer.phase == TimerPhase_RUNNING) {
+            format_seconds(buffer, "Time elapsed", (int)elapsed);
             ImGui::Text(buffer);
 
             if (ImGui::Button("Pause"))
             {
-                current_time_at_pause = current_time;
-                state->pause_time = current_time - state->pause_elapsed;
-                state->paused = true;
+                timer_pause(&state->timer, clock);
             }
         }
         else {
-            state->pause_elapsed = (int16)(current_time - state->pause_time);
             if (ImGui::Button("Resume")) {
-                state->paused = false;
+                timer_resume(&state->timer, clock);
             }
 
-            format_seconds(buffer, "PAUSED for", (int)(current_time - current_time_at_pause));
+            format_seconds(buffer, "PAUSED for", (int)(timer_paused_for_ns(&state->timer, clock) / NS_PER_SECOND));
             ImGui::Text(buffer);
+            if (state->timer.paused_by_sleep) {
+                format_seconds(buffer, "The computer slept for", (int)(state->timer.slept_ns / NS_PER_SECOND));
+                ImGui::Text(buffer);
+            }
         }
 
         ImGui::SameLine(0, 30);
@@ -294,39 +724,56 @@ timer_step_and_render(TimerState* state) {
         if (stopping) {
             state->prev_phrase = state->curr_phrase;
             state->curr_phrase = NULL;
-            state->started = false;
-            state->pause_elapsed = 0;
-            state->paused = false;
+            timer_stop(&state->timer, clock);
             TimeRecord record = {};
             record.timestamp = current_time;
 
-            // This can happen if we leave a timer running and the computer goes to sleep.
+            // Sleep is never counted, but the frame that ends a session can
+            // come a little late.
             if (elapsed > time_unit_length) {
                 elapsed = time_unit_length;
             }
 
-            record.elapsed = elapsed;
+            record.elapsed = (int16)elapsed;
             state->num_seconds += elapsed;
-            state->records[state->num_records++] = record;
+            // Breaks don't count toward a project.
+            uint16 tag = TAG_NONE;
+            if (state->timer_type == TimerType_POMODORO) {
+                tag = record_tag_for(state, state->project);
+            }
+            record_append(state, record, tag);
             if (alert_user)
             {
-                platform_alert();
+                state->show_finished = true;
+                state->finished_type = state->timer_type;
+                state->finished_name[0] = '\0';
+                platform_alert(timer_finished_text(state, buffer));
             }
             platform_save_state(state);
         }
     }
     if (change_persp) {
-        state->num_seconds = 0;
-        for (int i = 0; i < state->num_records; ++i) {
-            if (state->records[i].timestamp >= state->time_persp) {
-                state->num_seconds += state->records[i].elapsed;
-            }
-        }
+        state->num_seconds = (int)record_seconds_since_persp(state);
     }
 
 
 
     ImGui::End();
+
+    named_timers_update(state, clock);
+    named_timers_render(state, clock, (int64)current_time);
+    heatmap_render(&state->heatmap, &state->rollups);
+
+    if (state->show_finished) {
+        ImGui::SetNextWindowPos({10, 265}, ImGuiSetCond_Appearing);
+        ImGui::Begin("Timer done", NULL, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoCollapse |
+                     ImGuiWindowFlags_NoSavedSettings);
+        ImGui::Text("%s", timer_finished_text(state, buffer));
+        if (ImGui::Button("OK")) {
+            state->show_finished = false;
+        }
+        ImGui::End();
+    }
+
     ImGui::PopStyleColor(style_stack);
-    ImGui::Render();
 }
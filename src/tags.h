@@ -0,0 +1,343 @@
+// tags.h
+//
+// Projects, as a tag on each record.
+//
+// A tag is a uint16 id into an interned string table, and the tags live in a
+// column of their own next to TimerState::records, so TimeRecord stays ten
+// bytes and everything that walks records never touches them. Tag 0,
+// TAG_NONE, is "untagged", which is what every record from before tags
+// existed is. Interned ids stop below TAG_TIMER, the tag of named timers'
+// records, which has no name and no posting list.
+//
+// Each tag has a posting list of its records: a RecordIndex over just those
+// records, so the time on one project in any range is two binary searches.
+// Like the main index, the posting lists are built on first use.
+//
+// The record tags are persisted with the records, by the journal and the
+// snapshot. The names are in solanum.tags next to solanum.dat:
+//
+//   TagFileHeader
+//   char names[size]   The names of tags 1 to num_tags - 1, each ending in NUL.
+
+#pragma once
+
+#define TAG_NONE 0
+#define TAG_MAX_TAGS 65535
+#define TAG_NAME_SIZE 32
+
+#define TAG_FILE_MAGIC 0x47415453  // "STAG"
+#define TAG_FILE_VERSION 1
+
+struct TagTable {
+    char* strings;      // Names back to back, each ending in NUL.
+    int64 strings_size;
+    int64 strings_capacity;
+    uint32* offsets;    // Where each tag's name starts in strings.
+    int num_tags;       // Including TAG_NONE, once anything was interned.
+    int offsets_capacity;
+    uint16* slots;      // Open addressing on the name hash. 0 is an empty slot.
+    int num_slots;      // A power of two, at least twice num_tags.
+};
+
+struct Tags {
+    TagTable table;
+    uint16* record_tags;   // Parallel to TimerState::records.
+    int64 capacity;
+    RecordIndex* postings; // One per tag. Unused for TAG_NONE.
+    int num_postings;
+    bool32 postings_built;
+};
+
+struct TagFileHeader {
+    uint32 magic;
+    uint32 version;
+    uint32 num_tags;
+    uint32 size;
+    uint32 crc;  // CRC32C of the names.
+};
+
+static uint32
+tag_hash(const char* name) {
+    uint32 hash = 2166136261u;
+    for (const char* c = name; *c; ++c) {
+        hash ^= (uint8)*c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static const char*
+tag_name(TagTable* table, uint16 tag) {
+    return tag != TAG_NONE && tag < table->num_tags ? table->strings + table->offsets[tag] : "";
+}
+
+// The slot holding name, or the empty slot where it would go.
+static int
+tag_table_slot(TagTable* table, const char* name) {
+    int mask = table->num_slots - 1;
+    int slot = (int)(tag_hash(name) & (uint32)mask);
+    while (table->slots[slot] && strcmp(tag_name(table, table->slots[slot]), name)) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static uint16
+tag_table_find(TagTable* table, const char* name) {
+    if (!name[0] || !table->num_slots) {
+        return TAG_NONE;
+    }
+    return table->slots[tag_table_slot(table, name)];
+}
+
+static bool32
+tag_table_rehash(TagTable* table, int num_slots) {
+    uint16* slots = (uint16*)calloc((size_t)num_slots, sizeof(uint16));
+    if (!slots) {
+        return false;
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->num_slots = num_slots;
+    for (int tag = 1; tag < table->num_tags; ++tag) {
+        table->slots[tag_table_slot(table, tag_name(table, (uint16)tag))] = (uint16)tag;
+    }
+    return true;
+}
+
+// The id of name, adding it if it is new. Names are cut to TAG_NAME_SIZE - 1
+// bytes. Returns TAG_NONE for an empty name, or when out of ids or memory.
+static uint16
+tag_table_intern(TagTable* table, const char* name) {
+    char cut[TAG_NAME_SIZE];
+    snprintf(cut, TAG_NAME_SIZE, "%s", name);
+    uint16 tag = tag_table_find(table, cut);
+    if (tag != TAG_NONE || !cut[0] || table->num_tags == TAG_MAX_TAGS) {
+        return tag;
+    }
+    if (!table->num_tags) {
+        table->num_tags = 1;  // TAG_NONE
+    }
+    if (table->num_tags >= table->offsets_capacity) {
+        int capacity = table->offsets_capacity ? table->offsets_capacity * 2 : 64;
+        uint32* offsets = (uint32*)realloc(table->offsets, (size_t)capacity * sizeof(uint32));
+        if (!offsets) {
+            return TAG_NONE;
+        }
+        table->offsets = offsets;
+        table->offsets_capacity = capacity;
+    }
+    int64 length = (int64)strlen(cut) + 1;
+    if (table->strings_size + length > table->strings_capacity) {
+        int64 capacity = table->strings_capacity ? table->strings_capacity * 2 : 1024;
+        char* strings = (char*)realloc(table->strings, (size_t)capacity);
+        if (!strings) {
+            return TAG_NONE;
+        }
+        table->strings = strings;
+        table->strings_capacity = capacity;
+    }
+    if (2 * (table->num_tags + 1) > table->num_slots &&
+        !tag_table_rehash(table, table->num_slots ? table->num_slots * 2 : 128)) {
+        return TAG_NONE;
+    }
+    tag = (uint16)table->num_tags++;
+    table->offsets[tag] = (uint32)table->strings_size;
+    memcpy(table->strings + table->strings_size, cut, (size_t)length);
+    table->strings_size += length;
+    table->slots[tag_table_slot(table, cut)] = tag;
+    return tag;
+}
+
+static bool32
+tags_reserve(Tags* tags, int64 count) {
+    if (count <= tags->capacity) {
+        return true;
+    }
+    int64 capacity = tags->capacity ? tags->capacity : 1024;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    uint16* record_tags = (uint16*)realloc(tags->record_tags, (size_t)capacity * sizeof(uint16));
+    if (!record_tags) {
+        return false;
+    }
+    memset(record_tags + tags->capacity, 0, (size_t)(capacity - tags->capacity) * sizeof(uint16));
+    tags->record_tags = record_tags;
+    tags->capacity = capacity;
+    return true;
+}
+
+static void
+tags_free_postings(Tags* tags) {
+    for (int tag = 0; tag < tags->num_postings; ++tag) {
+        record_index_free(&tags->postings[tag]);
+    }
+    free(tags->postings);
+    tags->postings = NULL;
+    tags->num_postings = 0;
+    tags->postings_built = false;
+}
+
+static void
+tags_free(Tags* tags) {
+    tags_free_postings(tags);
+    free(tags->table.strings);
+    free(tags->table.offsets);
+    free(tags->table.slots);
+    free(tags->record_tags);
+    *tags = {};
+}
+
+static bool32
+tags_build_postings(Tags* tags, TimeRecord* records, int64 num_records) {
+    tags_free_postings(tags);
+    int num_postings = tags->table.num_tags ? tags->table.num_tags : 1;
+    tags->postings = (RecordIndex*)calloc((size_t)num_postings, sizeof(RecordIndex));
+    if (!tags->postings) {
+        return false;
+    }
+    tags->num_postings = num_postings;
+    for (int64 i = 0; i < num_records; ++i) {
+        uint16 tag = tags->record_tags[i];
+        if (tag != TAG_NONE && tag < num_postings) {
+            ++tags->postings[tag].count;
+        }
+    }
+    for (int tag = 1; tag < num_postings; ++tag) {
+        RecordIndex* posting = &tags->postings[tag];
+        int64 count = posting->count;
+        posting->count = 0;
+        if (!record_index_reserve(posting, count)) {
+            tags_free_postings(tags);
+            return false;
+        }
+        posting->built = true;
+    }
+    // Records are mostly in time order, so this is mostly appends.
+    for (int64 i = 0; i < num_records; ++i) {
+        uint16 tag = tags->record_tags[i];
+        if (tag != TAG_NONE && tag < num_postings) {
+            record_index_insert(&tags->postings[tag], records, i);
+        }
+    }
+    tags->postings_built = true;
+    return true;
+}
+
+// The posting list of tag, if it is up to date.
+static RecordIndex*
+tags_posting(Tags* tags, uint16 tag) {
+    if (!tags->postings_built || tag == TAG_NONE || tag >= tags->num_postings ||
+        !tags->postings[tag].built) {
+        return NULL;
+    }
+    return &tags->postings[tag];
+}
+
+// Sets the tag of records[record_id].
+static void
+tags_set(Tags* tags, TimeRecord* records, int64 record_id, uint16 tag) {
+    uint16 old_tag = tags->record_tags[record_id];
+    if (old_tag == tag) {
+        return;
+    }
+    tags->record_tags[record_id] = tag;
+    if (!tags->postings_built) {
+        return;
+    }
+    if (tag >= tags->num_postings && tag != TAG_TIMER) {
+        // A tag interned since the lists were built. Build them again on use.
+        tags_free_postings(tags);
+        return;
+    }
+    RecordIndex* old_posting = tags_posting(tags, old_tag);
+    if (old_posting) {
+        record_index_remove(old_posting, records, record_id);
+    }
+    RecordIndex* posting = tags_posting(tags, tag);
+    if (posting) {
+        record_index_insert(posting, records, record_id);
+    }
+}
+
+// Called after records[record_id] was appended. New records are untagged.
+static void
+tags_on_append(Tags* tags, int64 record_id) {
+    tags->record_tags[record_id] = TAG_NONE;
+}
+
+// Called after records[record_id] was changed in place.
+static void
+tags_on_edit(Tags* tags, TimeRecord* records, int64 record_id) {
+    RecordIndex* posting = tags_posting(tags, tags->record_tags[record_id]);
+    if (posting) {
+        record_index_on_edit(posting, records, record_id);
+    }
+}
+
+// Called after the records from num_records on were dropped.
+static void
+tags_on_truncate(Tags* tags, TimeRecord* records, int64 num_records) {
+    for (int tag = 1; tags->postings_built && tag < tags->num_postings; ++tag) {
+        record_index_on_truncate_partial(&tags->postings[tag], records, num_records);
+    }
+}
+
+// Seconds logged on tag in [from, to).
+static int64
+tags_seconds_between(Tags* tags, TimeRecord* records, int64 num_records, uint16 tag, int64 from, int64 to) {
+    if (tag == TAG_NONE) {
+        return 0;
+    }
+    if (!tags->postings_built) {
+        tags_build_postings(tags, records, num_records);
+    }
+    RecordIndex* posting = tags_posting(tags, tag);
+    if (!posting) {
+        int64 seconds = 0;
+        for (int64 i = 0; i < num_records; ++i) {
+            if (tags->record_tags[i] == tag && records[i].timestamp >= from && records[i].timestamp < to) {
+                seconds += records[i].elapsed;
+            }
+        }
+        return seconds;
+    }
+    return record_index_seconds_since(posting, records, NULL, num_records, from) -
+            record_index_seconds_since(posting, records, NULL, num_records, to);
+}
+
+static bool32
+tags_write_names(FILE* fd, TagTable* table) {
+    TagFileHeader header = {};
+    header.magic = TAG_FILE_MAGIC;
+    header.version = TAG_FILE_VERSION;
+    header.num_tags = (uint32)table->num_tags;
+    header.size = (uint32)table->strings_size;
+    header.crc = crc32c(0, table->strings, (size_t)table->strings_size);
+    return fwrite(&header, sizeof(header), 1, fd) == 1 &&
+            fwrite(table->strings, 1, (size_t)table->strings_size, fd) == (size_t)table->strings_size;
+}
+
+// Interns the names in fd in order, so every tag gets back its id.
+static bool32
+tags_read_names(FILE* fd, TagTable* table) {
+    TagFileHeader header = {};
+    if (fread(&header, sizeof(header), 1, fd) != 1 ||
+        header.magic != TAG_FILE_MAGIC || header.version != TAG_FILE_VERSION ||
+        header.num_tags > TAG_MAX_TAGS) {
+        return false;
+    }
+    char* names = (char*)malloc((size_t)header.size + 1);
+    bool32 ok = names &&
+            fread(names, 1, header.size, fd) == header.size &&
+            crc32c(0, names, header.size) == header.crc;
+    for (uint32 at = 0, tag = 1; ok && tag < header.num_tags; ++tag) {
+        char* name = names + at;
+        size_t length = at < header.size ? strnlen(name, header.size - at) : 0;
+        ok = at + length < header.size && tag_table_intern(table, name) == tag;
+        at += (uint32)length + 1;
+    }
+    free(names);
+    return ok;
+}
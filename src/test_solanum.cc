@@ -0,0 +1,364 @@
+// test_solanum.cc
+//
+// Tests for the paths that only run when something went wrong, and so are
+// never exercised by using the app. Like the benchmarks, it needs no window or
+// GL context. Files go in the current directory.
+//
+//   test_solanum
+
+#include "system_includes.h"
+
+#include <fcntl.h>
+#ifndef _WIN32
+#define MAX_PATH 1024
+#include <unistd.h>
+#endif
+#include <errno.h>
+#include <sys/stat.h>
+
+// Platform services. Nothing here saves or grows through them.
+void platform_alert(const char* message) {}
+void platform_quit() {}
+struct TimerState;
+void platform_save_state(TimerState* state);
+bool platform_grow_records(TimerState* state);
+int64_t platform_monotonic_ns();
+int64_t platform_suspended_ns();
+bool platform_save_failed();
+void platform_save_tag_names(TimerState* state);
+
+#include "solanum.h"
+#include "file_helpers.h"
+#include "snapshot.h"
+#include "journal.h"
+#include "record_store.h"
+#include "archive.h"
+
+void platform_save_state(TimerState* state) { state->num_pending_entries = 0; }
+bool platform_grow_records(TimerState* state) { return false; }
+int64 platform_monotonic_ns() { return 0; }
+int64 platform_suspended_ns() { return 0; }
+bool platform_save_failed() { return false; }
+void platform_save_tag_names(TimerState* state) {}
+
+static int g_num_failed;
+
+#define TEST_CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            ++g_num_failed; \
+        } \
+    } while (0)
+
+#define TEST_DATA_PATH "test_solanum.dat"
+#define TEST_JOURNAL_PATH "test_solanum.jnl"
+#define TEST_ARCHIVE_PATH "test_solanum.sarc"
+
+static JournalEntry
+test_entry(RecordOp op, int64 index, int64 timestamp, uint16 tag) {
+    JournalEntry entry = {};
+    entry.op = (uint8)op;
+    entry.index = index;
+    entry.record.timestamp = timestamp;
+    entry.record.elapsed = 25 * 60;
+    entry.tag = tag;
+    return entry;
+}
+
+// Replays the test journal on top of what the store mapped, as journal_load
+// does. Returns the valid bytes and leaves the journal's size in file_size.
+static int64
+test_replay(RecordStore* store, TimerState* state, bool32 stop_at_gap, int64* file_size) {
+    FILE* fd = fopen(TEST_JOURNAL_PATH, "rb");
+    if (!fd) {
+        return -2;
+    }
+    fseek(fd, 0, SEEK_END);
+    *file_size = (int64)ftell(fd);
+    fseek(fd, 0, SEEK_SET);
+    size_t max_records = (size_t)state->num_records + (size_t)(*file_size / (int64)sizeof(JournalEntry));
+    int64 valid_bytes = -2;
+    int64 num_entries = 0;
+    if (record_store_grow(store, state, max_records) &&
+        tags_reserve(&state->tags, (int64)state->records_size)) {
+        valid_bytes = journal_replay(fd, *file_size, state->records, state->tags.record_tags,
+                                     state->records_size, &state->num_records, &num_entries, stop_at_gap);
+    }
+    fclose(fd);
+    return valid_bytes;
+}
+
+// A compacted snapshot with entries logged after the compaction, then the
+// snapshot loses its end. The entries that build on the lost records must not
+// stop us from loading the ones that survived.
+static void
+test_truncated_snapshot_with_journal() {
+    const int64 num_records = 3 * SNAPSHOT_RECORDS_PER_BLOCK + 100;
+    TimeRecord* records = (TimeRecord*)calloc((size_t)num_records, sizeof(TimeRecord));
+    uint16* tags = (uint16*)calloc((size_t)num_records, sizeof(uint16));
+    TEST_CHECK(records && tags);
+    if (!records || !tags) {
+        return;
+    }
+    for (int64 i = 0; i < num_records; ++i) {
+        records[i].timestamp = 1500000000 + i * 3600;
+        records[i].elapsed = 25 * 60;
+        tags[i] = (uint16)(i % 3);
+    }
+    FILE* fd = fopen(TEST_DATA_PATH, "wb");
+    TEST_CHECK(fd && snapshot_write(fd, records, tags, num_records));
+    if (fd) {
+        fclose(fd);
+    }
+
+    // What the journal looks like right after compaction: appends past the
+    // end of the snapshot, with an edit and a tag of older records in front.
+    int64 t = records[num_records - 1].timestamp;
+    JournalEntry entries[] = {
+        test_entry(RecordOp_EDIT, 7, records[7].timestamp + 60, TAG_NONE),
+        test_entry(RecordOp_TAG, 8, 0, 2),
+        test_entry(RecordOp_APPEND, num_records, t + 3600, TAG_NONE),
+        test_entry(RecordOp_TAG, num_records, 0, 1),
+        test_entry(RecordOp_APPEND, num_records + 1, t + 7200, TAG_NONE),
+    };
+    int num_entries = (int)(sizeof(entries) / sizeof(entries[0]));
+    fd = fopen(TEST_JOURNAL_PATH, "wb");
+    TEST_CHECK(fd && journal_write_header(fd) && journal_write_entries(fd, entries, num_entries));
+    if (fd) {
+        fclose(fd);
+    }
+
+    // Cut the snapshot in the middle of its second block.
+    SnapshotInfo info = {};
+    fd = fopen(TEST_DATA_PATH, "r+b");
+    TEST_CHECK(fd != NULL);
+    if (fd) {
+        snapshot_read_info(fd, &info);
+        truncate_file(fd, info.data_offset + (SNAPSHOT_RECORDS_PER_BLOCK + 10) * (int64)sizeof(TimeRecord) + 3);
+        fclose(fd);
+    }
+
+    RecordStore store;
+    TimerState* state = (TimerState*)calloc(1, sizeof(TimerState));
+    TEST_CHECK(record_store_open(&store, state, TEST_DATA_PATH, &info));
+    TEST_CHECK(info.status == SnapshotStatus_TRUNCATED);
+    TEST_CHECK(info.num_records == num_records);
+    TEST_CHECK(info.num_valid == SNAPSHOT_RECORDS_PER_BLOCK);
+    TEST_CHECK(state->num_records == SNAPSHOT_RECORDS_PER_BLOCK);
+
+    // Replaying all of it fails at the first append past the gap.
+    int64 file_size = 0;
+    TEST_CHECK(test_replay(&store, state, false, &file_size) == -1);
+
+    // Stopping there keeps everything before it.
+    state->num_records = info.num_valid;
+    int64 valid_bytes = test_replay(&store, state, true, &file_size);
+    TEST_CHECK(valid_bytes == (int64)sizeof(JournalHeader) + 2 * (int64)sizeof(JournalEntry));
+    TEST_CHECK(file_size == (int64)sizeof(JournalHeader) + num_entries * (int64)sizeof(JournalEntry));
+    TEST_CHECK(state->num_records == SNAPSHOT_RECORDS_PER_BLOCK);
+    TEST_CHECK(state->records[7].timestamp == records[7].timestamp + 60);
+    TEST_CHECK(state->tags.record_tags[8] == 2);
+    TEST_CHECK(state->tags.record_tags[9] == tags[9]);
+    TEST_CHECK(!memcmp(state->records + 8, records + 8,
+                       (size_t)(SNAPSHOT_RECORDS_PER_BLOCK - 8) * sizeof(TimeRecord)));
+
+    // Cut at that point, the journal replays cleanly on the same snapshot,
+    // and appends logged from here on go right after it.
+    fd = fopen(TEST_JOURNAL_PATH, "r+b");
+    TEST_CHECK(fd != NULL);
+    if (fd) {
+        truncate_file(fd, valid_bytes);
+        fseek(fd, 0, SEEK_END);
+        JournalEntry append = test_entry(RecordOp_APPEND, state->num_records, t + 3600, TAG_NONE);
+        TEST_CHECK(journal_write_entries(fd, &append, 1));
+        fclose(fd);
+    }
+    tags_free(&state->tags);
+    *state = {};
+    TEST_CHECK(record_store_open(&store, state, TEST_DATA_PATH, &info));
+    TEST_CHECK(test_replay(&store, state, false, &file_size) == file_size);
+    TEST_CHECK(state->num_records == SNAPSHOT_RECORDS_PER_BLOCK + 1);
+    TEST_CHECK(state->records[SNAPSHOT_RECORDS_PER_BLOCK].timestamp == t + 3600);
+
+    // Compacting what we recovered gives a snapshot that is whole again.
+    fd = fopen(TEST_DATA_PATH ".tmp", "wb");
+    TEST_CHECK(fd && snapshot_write(fd, state->records, state->tags.record_tags, state->num_records));
+    if (fd) {
+        fclose(fd);
+    }
+    TEST_CHECK(replace_file(TEST_DATA_PATH ".tmp", TEST_DATA_PATH));
+    int64 recovered = state->num_records;
+    tags_free(&state->tags);
+    *state = {};
+    TEST_CHECK(record_store_open(&store, state, TEST_DATA_PATH, &info));
+    TEST_CHECK(info.status == SnapshotStatus_OK);
+    TEST_CHECK(state->num_records == recovered);
+
+    tags_free(&state->tags);
+    free(state);
+    free(records);
+    free(tags);
+    remove(TEST_DATA_PATH);
+    remove(TEST_JOURNAL_PATH);
+}
+
+// A posting list covers only its tag's records, so deleting the last record
+// must take it out of its tag's list whatever the other lists hold.
+static void
+test_truncate_tagged_record() {
+    TimerState* state = (TimerState*)calloc(1, sizeof(TimerState));
+    state->records_size = 16;
+    state->records = (TimeRecord*)calloc(state->records_size, sizeof(TimeRecord));
+    uint16 work = tag_table_intern(&state->tags.table, "work");
+    for (int i = 0; i < 4; ++i) {
+        TimeRecord record = { 100, 1500000000 + i * 600 };
+        record_append(state, record, i ? work : TAG_NONE);
+    }
+    TEST_CHECK(tags_seconds_between(&state->tags, state->records, state->num_records, work, 0, INT64_MAX) == 300);
+    record_truncate(state, 3);
+    TEST_CHECK(tags_seconds_between(&state->tags, state->records, state->num_records, work, 0, INT64_MAX) == 200);
+    // The next record gets the id of the deleted one.
+    TimeRecord record = { 100, 1500000000 + 4 * 600 };
+    record_append(state, record, work);
+    TEST_CHECK(tags_seconds_between(&state->tags, state->records, state->num_records, work, 0, INT64_MAX) == 300);
+
+    record_index_free(&state->index);
+    record_columns_free(&state->columns);
+    tags_free(&state->tags);
+    free(state->records);
+    free(state);
+}
+
+// What a named timer logs is not focus time, on this machine or another, and
+// its name is not a project.
+static void
+test_named_timer_not_focus() {
+    TimerState* state = (TimerState*)calloc(1, sizeof(TimerState));
+    state->records_size = 16;
+    state->records = (TimeRecord*)calloc(state->records_size, sizeof(TimeRecord));
+    int64 t = 1500000000;
+    TimeRecord pomodoro = { 25 * 60, t };
+    TimeRecord tea = { 5 * 60, t + 600 };
+    record_append(state, pomodoro, TAG_NONE);
+    record_seconds_since_persp(state);  // Builds the index before the timer's record.
+    record_append(state, tea, TAG_TIMER);
+    TEST_CHECK(state->tags.table.num_tags == 0);
+    TEST_CHECK(record_seconds_since_persp(state) == 25 * 60);
+    TEST_CHECK(rollup_table_get_at(&state->rollups, RollupPeriod_DAY, t).seconds == 25 * 60);
+    TEST_CHECK(rollup_table_get_at(&state->rollups, RollupPeriod_DAY, t).count == 1);
+    rollup_table_build(&state->rollups, &state->columns, state->records, state->tags.record_tags,
+                       state->num_records);
+    TEST_CHECK(rollup_table_get_at(&state->rollups, RollupPeriod_DAY, t).seconds == 25 * 60);
+
+    // Deleting it leaves the focus records alone.
+    record_truncate(state, 1);
+    TEST_CHECK(state->index.built && state->index.count == 1);
+    TEST_CHECK(record_seconds_since_persp(state) == 25 * 60);
+
+    // Another machine's timer record doesn't come in with its sessions.
+    MergeSource* source = history_merge_source(&state->peers, "other");
+    TEST_CHECK(source && merge_source_reserve(source, 2));
+    if (source) {
+        source->present = true;
+        source->records[0] = { 25 * 60, t + 3600 };
+        source->tags[0] = TAG_NONE;
+        source->records[1] = { 5 * 60, t + 7200 };
+        source->tags[1] = TAG_TIMER;
+        source->num_records = 2;
+        record_merge_peers(state);
+        TEST_CHECK(state->peers.num_records == 1);
+        TEST_CHECK(record_seconds_since_persp(state) == 2 * 25 * 60);
+    }
+
+    history_merge_free(&state->peers);
+    rollup_table_free(&state->rollups);
+    record_index_free(&state->index);
+    record_columns_free(&state->columns);
+    tags_free(&state->tags);
+    free(state->records);
+    free(state);
+}
+
+// An export decodes back to the records it was written from, across block
+// boundaries, and its footers agree with them.
+static void
+test_archive_round_trip() {
+    int64 num_records = 2 * ARCHIVE_BLOCK_RECORDS + 100;
+    TimeRecord* records = (TimeRecord*)calloc((size_t)num_records, sizeof(TimeRecord));
+    int64 t = 1500000000;
+    for (int64 i = 0; i < num_records; ++i) {
+        t += i % 7 == 0 ? 86400 + i % 13 : 1800;
+        records[i].timestamp = t;
+        records[i].elapsed = (int16)(i % 5 == 0 ? 300 : 25 * 60 - i % 3);
+    }
+    FILE* fd = fopen(TEST_ARCHIVE_PATH, "wb");
+    TEST_CHECK(fd && archive_write(fd, records, num_records));
+    if (fd) {
+        fclose(fd);
+    }
+
+    fd = fopen(TEST_ARCHIVE_PATH, "rb");
+    TEST_CHECK(fd);
+    if (fd) {
+        int64 num_read = 0;
+        TimeRecord* read = archive_read(fd, &num_read);
+        TEST_CHECK(read && num_read == num_records);
+        if (read && num_read == num_records) {
+            TEST_CHECK(memcmp(read, records, (size_t)num_records * sizeof(TimeRecord)) == 0);
+        }
+        free(read);
+
+        ArchiveTrailer trailer = {};
+        ArchiveBlockFooter footers[3] = {};
+        fseek(fd, -(long)(sizeof(trailer) + sizeof(footers)), SEEK_END);
+        TEST_CHECK(fread(footers, sizeof(footers), 1, fd) == 1 && fread(&trailer, sizeof(trailer), 1, fd) == 1);
+        TEST_CHECK(trailer.num_blocks == 3 && trailer.num_records == num_records);
+        for (int b = 0; b < 3; ++b) {
+            const TimeRecord* first = records + b * ARCHIVE_BLOCK_RECORDS;
+            int64 sum = 0;
+            for (uint32 i = 0; i < footers[b].count; ++i) {
+                sum += first[i].elapsed;
+            }
+            TEST_CHECK(footers[b].count == (b < 2 ? ARCHIVE_BLOCK_RECORDS : 100));
+            TEST_CHECK(footers[b].elapsed_sum == sum);
+            TEST_CHECK(footers[b].min_timestamp == first[0].timestamp);
+            TEST_CHECK(footers[b].max_timestamp == first[footers[b].count - 1].timestamp);
+        }
+        fclose(fd);
+    }
+
+    // A flipped byte in a block fails its checksum.
+    fd = fopen(TEST_ARCHIVE_PATH, "r+b");
+    if (fd) {
+        fseek(fd, sizeof(ArchiveHeader) + 10, SEEK_SET);
+        int c = fgetc(fd);
+        fseek(fd, sizeof(ArchiveHeader) + 10, SEEK_SET);
+        fputc(c ^ 0x40, fd);
+        fclose(fd);
+    }
+    fd = fopen(TEST_ARCHIVE_PATH, "rb");
+    if (fd) {
+        int64 num_read = 0;
+        TEST_CHECK(archive_read(fd, &num_read) == NULL);
+        fclose(fd);
+    }
+
+    free(records);
+    remove(TEST_ARCHIVE_PATH);
+}
+
+int
+main(int argc, char** argv) {
+    solanum_init_kernels();
+    test_truncated_snapshot_with_journal();
+    test_truncate_tagged_record();
+    test_named_timer_not_focus();
+    test_archive_round_trip();
+    if (g_num_failed) {
+        printf("%d checks failed.\n", g_num_failed);
+        return EXIT_FAILURE;
+    }
+    printf("All tests passed.\n");
+    return 0;
+}
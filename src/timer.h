@@ -0,0 +1,131 @@
+// timer.h
+//
+// The running pomodoro, measured on monotonic clocks. Wall-clock time jumps
+// with NTP, DST and manual changes, so it is only used to stamp the
+// TimeRecord a session produces.
+//
+//   STOPPED --start--> RUNNING --pause--> PAUSED --resume--> RUNNING
+//   RUNNING or PAUSED --stop--> STOPPED
+//
+// Run time is counted on a clock that stops while the machine is suspended,
+// so a session never logs the time the laptop spent with its lid closed.
+// Comparing it with a clock that keeps going tells us how long the machine
+// slept. When that happens during a run, the timer pauses itself as of the
+// moment the machine went to sleep and says so.
+//
+// All durations are int64 nanoseconds, so nothing overflows however long a
+// timer is left running or paused.
+
+#pragma once
+
+#define NS_PER_SECOND ((int64)1000 * 1000 * 1000)
+
+// Shorter gaps between the two clocks are read jitter, not sleep.
+#define TIMER_MIN_SLEEP_NS NS_PER_SECOND
+
+// One reading of both clocks. awake_ns stops while the machine is suspended
+// and asleep_ns is the total time it was suspended, so their sum is real
+// elapsed time.
+struct TimerClock {
+    int64 awake_ns;
+    int64 asleep_ns;
+};
+
+enum TimerPhase {
+    TimerPhase_STOPPED,
+    TimerPhase_RUNNING,
+    TimerPhase_PAUSED,
+};
+
+struct Timer {
+    TimerPhase phase;
+    int64 resumed_ns;  // Awake time when the current run of the timer started.
+    int64 banked_ns;   // Time run before the last pause.
+    int64 paused_ns;   // Real time when the current pause started.
+
+    int64 asleep_ns;           // asleep_ns as of the last check.
+    int64 slept_ns;            // Time the machine slept during this session.
+    bool32 paused_by_sleep;
+};
+
+static void
+timer_start(Timer* timer, TimerClock clock) {
+    *timer = {};
+    timer->phase = TimerPhase_RUNNING;
+    timer->resumed_ns = clock.awake_ns;
+    timer->asleep_ns = clock.asleep_ns;
+}
+
+static void
+timer_pause(Timer* timer, TimerClock clock) {
+    if (timer->phase == TimerPhase_RUNNING) {
+        timer->banked_ns += clock.awake_ns - timer->resumed_ns;
+        timer->paused_ns = clock.awake_ns + clock.asleep_ns;
+        timer->phase = TimerPhase_PAUSED;
+    }
+}
+
+static void
+timer_resume(Timer* timer, TimerClock clock) {
+    if (timer->phase == TimerPhase_PAUSED) {
+        timer->resumed_ns = clock.awake_ns;
+        timer->phase = TimerPhase_RUNNING;
+        timer->paused_by_sleep = false;
+    }
+}
+
+// Call whenever the timer is looked at. Returns true if the machine slept
+// since the last call; a running timer is then paused as of the moment the
+// machine went to sleep.
+static bool32
+timer_check_sleep(Timer* timer, TimerClock clock) {
+    int64 slept_ns = clock.asleep_ns - timer->asleep_ns;
+    if (timer->phase == TimerPhase_STOPPED || slept_ns < TIMER_MIN_SLEEP_NS) {
+        return false;
+    }
+    timer->asleep_ns = clock.asleep_ns;
+    timer->slept_ns += slept_ns;
+    if (timer->phase == TimerPhase_RUNNING) {
+        timer_pause(timer, clock);
+        timer->paused_ns -= slept_ns;
+        timer->paused_by_sleep = true;
+    }
+    return true;
+}
+
+// Time the timer has been running, not counting pauses or sleep.
+static int64
+timer_elapsed_ns(Timer* timer, TimerClock clock) {
+    switch (timer->phase) {
+        case TimerPhase_RUNNING: return timer->banked_ns + (clock.awake_ns - timer->resumed_ns);
+        case TimerPhase_PAUSED: return timer->banked_ns;
+        case TimerPhase_STOPPED: return 0;
+    }
+    return 0;
+}
+
+// Length of the current pause, in real time.
+static int64
+timer_paused_for_ns(Timer* timer, TimerClock clock) {
+    return timer->phase == TimerPhase_PAUSED ? clock.awake_ns + clock.asleep_ns - timer->paused_ns : 0;
+}
+
+// Stops the timer and returns how long it ran.
+static int64
+timer_stop(Timer* timer, TimerClock clock) {
+    int64 elapsed_ns = timer_elapsed_ns(timer, clock);
+    *timer = {};
+    return elapsed_ns;
+}
+
+// The clock the user is looking at: time run, or time paused.
+static int64
+timer_displayed_ns(Timer* timer, TimerClock clock) {
+    return timer->phase == TimerPhase_PAUSED ? timer_paused_for_ns(timer, clock) : timer_elapsed_ns(timer, clock);
+}
+
+// Nanoseconds until the displayed clock shows the next second.
+static int64
+timer_ns_to_next_second(Timer* timer, TimerClock clock) {
+    return NS_PER_SECOND - timer_displayed_ns(timer, clock) % NS_PER_SECOND;
+}
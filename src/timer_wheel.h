@@ -0,0 +1,187 @@
+// timer_wheel.h
+//
+// Deadlines for many timers at once, as a hierarchical timer wheel.
+//
+// Time is in ticks. Level 0 has a slot for each of the next 64 ticks, level 1
+// a slot for each of the next 64 spans of 64 ticks, and so on. A deadline
+// goes into the coarsest level it fits, and is moved down a level whenever
+// the wheel reaches the start of its slot, so it lands in level 0 exactly in
+// time to expire. Adding, removing and expiring are constant time, and a
+// bitmap of occupied slots per level lets the wheel jump over empty
+// stretches instead of visiting every tick.
+//
+// Timers are identified by small integers, 1 to TIMER_WHEEL_MAX_ID. Zero
+// means "none", so a zeroed wheel is empty and ready to use.
+
+#pragma once
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 6  // 64^6 ticks; with millisecond ticks, thousands of years.
+#define TIMER_WHEEL_MAX_ID 63
+
+struct TimerWheelEntry {
+    int64 expires;
+    int next;
+    int prev;
+    int level;
+    int slot;
+    bool32 queued;
+};
+
+struct TimerWheel {
+    int64 now;  // First tick not yet expired.
+    uint64 occupied[TIMER_WHEEL_LEVELS];
+    int heads[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    TimerWheelEntry entries[TIMER_WHEEL_MAX_ID + 1];
+};
+
+static int
+timer_wheel_lowest_bit(uint64 bits) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return (int)index;
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+static void
+timer_wheel_link(TimerWheel* wheel, int id) {
+    TimerWheelEntry* entry = &wheel->entries[id];
+    int64 delta = entry->expires - wheel->now;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (int64)1 << (TIMER_WHEEL_BITS * (level + 1))) {
+        ++level;
+    }
+    int slot = (int)((entry->expires >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1));
+    entry->level = level;
+    entry->slot = slot;
+    entry->queued = true;
+    entry->prev = 0;
+    entry->next = wheel->heads[level][slot];
+    if (entry->next) {
+        wheel->entries[entry->next].prev = id;
+    }
+    wheel->heads[level][slot] = id;
+    wheel->occupied[level] |= (uint64)1 << slot;
+}
+
+static void
+timer_wheel_remove(TimerWheel* wheel, int id) {
+    TimerWheelEntry* entry = &wheel->entries[id];
+    if (!entry->queued) {
+        return;
+    }
+    if (entry->prev) {
+        wheel->entries[entry->prev].next = entry->next;
+    }
+    else {
+        wheel->heads[entry->level][entry->slot] = entry->next;
+        if (!entry->next) {
+            wheel->occupied[entry->level] &= ~((uint64)1 << entry->slot);
+        }
+    }
+    if (entry->next) {
+        wheel->entries[entry->next].prev = entry->prev;
+    }
+    *entry = {};
+}
+
+// Schedules id to expire at the given tick, replacing any earlier deadline.
+// Deadlines in the past expire on the next advance.
+static void
+timer_wheel_add(TimerWheel* wheel, int id, int64 expires) {
+    timer_wheel_remove(wheel, id);
+    int64 latest = wheel->now + ((int64)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    wheel->entries[id].expires = expires < wheel->now ? wheel->now : expires < latest ? expires : latest;
+    timer_wheel_link(wheel, id);
+}
+
+// Empties one slot and returns the first timer of its list.
+static int
+timer_wheel_take_slot(TimerWheel* wheel, int level, int slot) {
+    int id = wheel->heads[level][slot];
+    wheel->heads[level][slot] = 0;
+    wheel->occupied[level] &= ~((uint64)1 << slot);
+    return id;
+}
+
+// The first tick at or after the wheel's position where something happens:
+// a timer expires or a slot moves down a level. -1 if the wheel is empty.
+static int64
+timer_wheel_next_tick(TimerWheel* wheel) {
+    int64 next = -1;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        uint64 bits = wheel->occupied[level];
+        if (!bits) {
+            continue;
+        }
+        int shift = TIMER_WHEEL_BITS * level;
+        int64 position = wheel->now >> shift;
+        int current = (int)(position & (TIMER_WHEEL_SLOTS - 1));
+        // Slots ahead of the current one are in this turn of the wheel, the
+        // rest in the next. The current slot is still due only if the wheel
+        // hasn't moved past its first tick; otherwise it was already emptied
+        // and anything in it is a full turn away.
+        bool32 at_slot_start = !(wheel->now & (((int64)1 << shift) - 1));
+        uint64 first = at_slot_start ? (uint64)1 << current : (uint64)2 << current;
+        uint64 ahead = bits & ~(first - 1);
+        int64 start = position & ~(int64)(TIMER_WHEEL_SLOTS - 1);
+        if (!ahead) {
+            ahead = bits;
+            start += TIMER_WHEEL_SLOTS;
+        }
+        int64 tick = (start + timer_wheel_lowest_bit(ahead)) << shift;
+        if (tick < wheel->now) {
+            tick = wheel->now;
+        }
+        if (next < 0 || tick < next) {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+// Moves the wheel up to and including tick `to`, writing the ids of the
+// timers that expired to `expired`, which must have room for
+// TIMER_WHEEL_MAX_ID ids. Returns how many expired.
+static int
+timer_wheel_advance(TimerWheel* wheel, int64 to, int* expired) {
+    int num_expired = 0;
+    while (wheel->now <= to) {
+        int64 next = timer_wheel_next_tick(wheel);
+        if (next < 0 || next > to) {
+            wheel->now = to + 1;
+            break;
+        }
+        wheel->now = next;
+
+        // Bring down the coarser slots that start here, finest last.
+        int top = 0;
+        while (top < TIMER_WHEEL_LEVELS - 1 &&
+               !(next & (((int64)1 << (TIMER_WHEEL_BITS * (top + 1))) - 1))) {
+            ++top;
+        }
+        for (int level = top; level > 0; --level) {
+            int slot = (int)((next >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1));
+            int id = timer_wheel_take_slot(wheel, level, slot);
+            while (id) {
+                int following = wheel->entries[id].next;
+                timer_wheel_link(wheel, id);
+                id = following;
+            }
+        }
+
+        int id = timer_wheel_take_slot(wheel, 0, (int)(next & (TIMER_WHEEL_SLOTS - 1)));
+        while (id) {
+            int following = wheel->entries[id].next;
+            wheel->entries[id] = {};
+            expired[num_expired++] = id;
+            id = following;
+        }
+        wheel->now = next + 1;
+    }
+    return num_expired;
+}
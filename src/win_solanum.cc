@@ -1,30 +1,45 @@
 #define GLCHK(stmt) stmt; gl_query_error(#stmt, __FILE__, __LINE__)
 #include "system_includes.h"
 #include "imgui_helpers.h"
+#include <io.h>
 
 // #define snprintf sprintf_s
 
 // Platform services:
-void platform_alert();
+void platform_alert(const char* message);
 void platform_quit();
 struct TimerState;
 void platform_save_state(TimerState* state);
+bool platform_grow_records(TimerState* state);
+int64_t platform_monotonic_ns();
+int64_t platform_suspended_ns();
+bool platform_save_failed();
+void platform_save_tag_names(TimerState* state);
 
 #include "solanum.h"
+#include "crc32c.h"
+#include "snapshot.h"
+#include "journal.h"
+#include "record_store.h"
 
 static HGLRC g_glcontext_handle;
 static TimerState g_timer_state;
+static RecordStore g_record_store;
 bool32 g_running = true;
 bool32 g_alert_flag;
+bool32 g_save_failed;
 
 void platform_quit()
 {
     g_running = false;
 }
 
-void platform_alert()
+// The toast is always drawn. Flashing and beeping are off when SOLANUM_NOTIFY
+// is set to 0.
+void platform_alert(const char* message)
 {
-    g_alert_flag = true;
+    const char* env = getenv("SOLANUM_NOTIFY");
+    g_alert_flag = !env || strcmp(env, "0") != 0;
 }
 
 void path_at_exe(char* full_path, int buffer_size, char* fname)
@@ -46,30 +61,66 @@ void path_at_exe(char* full_path, int buffer_size, char* fname)
     strcat(full_path, fname);
 }
 
+// Time the machine has been awake. Stands still while it is suspended.
+int64 platform_monotonic_ns()
+{
+    ULONGLONG unbiased;
+    QueryUnbiasedInterruptTime(&unbiased);
+    return (int64)unbiased * 100;
+}
+
+// Total time the machine has been suspended since it booted. The tick count
+// keeps going through sleep and the unbiased interrupt time doesn't.
+int64 platform_suspended_ns()
+{
+    ULONGLONG unbiased;
+    QueryUnbiasedInterruptTime(&unbiased);
+    return (int64)GetTickCount64() * 1000 * 1000 - (int64)unbiased * 100;
+}
+
+bool platform_grow_records(TimerState* state)
+{
+    return record_store_grow(&g_record_store, state, (size_t)state->num_records + 1);
+}
+
+// Appends pending changes to solanum.jnl. Compaction is left to the SDL build.
 void platform_save_state(TimerState* state)
 {
-    static int num_backups = 5;
-    static int backup_i = 0;
+    char journal_path[MAX_PATH];
+    path_at_exe(journal_path, MAX_PATH, "solanum.jnl");
 
-    char data_path[MAX_PATH];
-    path_at_exe(data_path, MAX_PATH, "solanum.dat");
-    char backup_path[MAX_PATH];
-    char fname[MAX_PATH];
-    sprintf(fname, "BAK%d_solanum.dat", backup_i);
-    path_at_exe(backup_path, MAX_PATH, fname);
-
-    CopyFile(
-            data_path,
-            backup_path,
-            FALSE);
-
-    FILE* fd = fopen(data_path, "wb");
-    assert(fd);
-    fwrite(&state->num_records, (size_t)(sizeof(int64)), 1, fd);
-    fwrite(state->records, sizeof(TimeRecord), (size_t)state->num_records, fd);
-    fclose(fd);
-
-    backup_i = (backup_i + 1) % num_backups;
+    FILE* fd = fopen(journal_path, "ab");
+    g_save_failed = !fd;
+    if (fd)
+    {
+        fseek(fd, 0, SEEK_END);
+        if (ftell(fd) == 0)
+        {
+            journal_write_header(fd);
+        }
+        g_save_failed = !journal_write_entries(fd, state->pending_entries, state->num_pending_entries) ||
+            fflush(fd) != 0 || _commit(_fileno(fd)) != 0;
+        fclose(fd);
+    }
+
+    state->num_pending_entries = 0;
+}
+
+void platform_save_tag_names(TimerState* state)
+{
+    char tags_path[MAX_PATH];
+    path_at_exe(tags_path, MAX_PATH, "solanum.tags");
+    FILE* fd = fopen(tags_path, "wb");
+    if (fd)
+    {
+        tags_write_names(fd, &state->tags.table);
+        fclose(fd);
+    }
+}
+
+bool platform_save_failed()
+{
+    return g_save_failed != 0;
 }
 
 inline void gl_query_error(const char* expr, const char* file, int line)
@@ -491,6 +542,8 @@ int CALLBACK WinMain(
         int nCmdShow
         )
 {
+    solanum_init_kernels();
+
     WNDCLASS window_class = {};
 
     window_class.style = CS_HREDRAW | CS_VREDRAW | CS_OWNDC;
@@ -508,7 +561,7 @@ int CALLBACK WinMain(
     int x = 100;
     int y = 100;
     int width = 500;
-    int height = 288;
+    int height = 340;
     HWND window = CreateWindowExA(
             WS_EX_LAYERED, //WS_EX_TOPMOST ,  // dwExStyle
             window_class.lpszClassName,     // class Name
@@ -544,29 +597,95 @@ int CALLBACK WinMain(
 
     char data_path[MAX_PATH];
     path_at_exe(data_path, MAX_PATH, "solanum.dat");
+    char rollups_path[MAX_PATH];
+    path_at_exe(rollups_path, MAX_PATH, "solanum.rollups");
 
     TimerState state = {};
     {
         state.time_unit_in_s = 60 * 30;
-        state.records_size = 1024 * 1024;
         time_t current_time;
         time(&current_time);
         state.time_persp = current_time;
-        state.records = (TimeRecord*) malloc(state.records_size * sizeof(TimeRecord));
         {
-
-            FILE* fd = fopen(data_path, "rb");
+            char tags_path[MAX_PATH];
+            path_at_exe(tags_path, MAX_PATH, "solanum.tags");
+            FILE* tags_fd = fopen(tags_path, "rb");
+            if (tags_fd)
+            {
+                tags_read_names(tags_fd, &state.tags.table);
+                fclose(tags_fd);
+            }
+        }
+        {
+            SnapshotInfo info;
+            if (!record_store_open(&g_record_store, &state, data_path, &info) ||
+                info.status == SnapshotStatus_CORRUPT)
+            {
+                return FALSE;
+            }
+            char journal_path[MAX_PATH];
+            path_at_exe(journal_path, MAX_PATH, "solanum.jnl");
+            FILE* fd = fopen(journal_path, "r+b");
             if (fd)
             {
-                fread(&state.num_records, (size_t)(sizeof(int64)), 1, fd);
-                if ((size_t)state.num_records > state.records_size)
+                fseek(fd, 0, SEEK_END);
+                int64 file_size = (int64)ftell(fd);
+                fseek(fd, 0, SEEK_SET);
+                size_t max_records = (size_t)state.num_records + (size_t)(file_size / (int64)sizeof(JournalEntry));
+                if (!record_store_grow(&g_record_store, &state, max_records) ||
+                    !tags_reserve(&state.tags, (int64)state.records_size))
                 {
+                    fclose(fd);
                     return FALSE;
                 }
-                fread(state.records, sizeof(TimeRecord), (size_t)state.num_records, fd);
+                // A truncated snapshot lost records the journal may build on.
+                // Replay what fits, and keep the whole journal next to it.
+                bool32 truncated = info.status == SnapshotStatus_TRUNCATED;
+                int64 num_entries = 0;
+                int64 valid_bytes = journal_replay(fd, file_size,
+                                                   state.records, state.tags.record_tags, state.records_size,
+                                                   &state.num_records, &num_entries, truncated);
+                if (valid_bytes < 0 || (valid_bytes == 0 && file_size >= (int64)sizeof(JournalHeader)))
+                {
+                    fclose(fd);
+                    return FALSE;
+                }
+                if (truncated && valid_bytes < file_size)
+                {
+                    char aside_path[MAX_PATH];
+                    path_at_exe(aside_path, MAX_PATH, "solanum.jnl.before_recovery");
+                    if (!CopyFileA(journal_path, aside_path, FALSE))
+                    {
+                        fclose(fd);
+                        return FALSE;
+                    }
+                }
+                // Cut off a torn tail so new entries don't land after it, and
+                // bring a v1 header up to the version we append.
+                fflush(fd);
+                _chsize_s(_fileno(fd), valid_bytes);
+                if (valid_bytes)
+                {
+                    fseek(fd, 0, SEEK_SET);
+                    journal_write_header(fd);
+                }
                 fclose(fd);
             }
         }
+        {
+            FILE* fd = fopen(rollups_path, "rb");
+            bool32 ok = fd && rollup_table_read(fd, &state.rollups, state.records, state.tags.record_tags,
+                                                state.num_records);
+            if (fd)
+            {
+                fclose(fd);
+            }
+            if (!ok)
+            {
+                rollup_table_build(&state.rollups, &state.columns, state.records, state.tags.record_tags,
+                                   state.num_records);
+            }
+        }
     }
     state.window_width = width;
     state.window_height = height;
@@ -574,7 +693,14 @@ int CALLBACK WinMain(
     {
         if (g_alert_flag)
         {
-            MessageBox(window, "Timer done", "Solanum", MB_OK | MB_SYSTEMMODAL);
+            // The toast is drawn in the window. Flash the taskbar button
+            // until the window gets focus.
+            FLASHWINFO flash = {};
+            flash.cbSize = sizeof(flash);
+            flash.hwnd = window;
+            flash.dwFlags = FLASHW_ALL | FLASHW_TIMERNOFG;
+            FlashWindowEx(&flash);
+            MessageBeep(MB_ICONASTERISK);
             g_alert_flag = false;
         }
         win32_process_input(window);
@@ -587,6 +713,14 @@ int CALLBACK WinMain(
         WaitMessage();
     }
     platform_save_state(&state);
+    {
+        FILE* fd = fopen(rollups_path, "wb");
+        if (fd)
+        {
+            rollup_table_write(fd, &state.rollups, state.records, state.tags.record_tags, state.num_records);
+            fclose(fd);
+        }
+    }
 
     return TRUE;
 }
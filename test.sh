@@ -0,0 +1,23 @@
+if [ ! -d build ]; then
+    mkdir build
+fi
+
+cd imgui
+clang++ imgui.cpp imgui_draw.cpp -g -c
+ar rcs imgui.a imgui_draw.o imgui.o
+cd ..
+
+cd build
+
+clang++ \
+  -O0 -g \
+  -std=c++11 \
+  -pthread \
+  -Wno-c++11-compat-deprecated-writable-strings \
+  `pkg-config --cflags glew` \
+  -I../third_party/ -I../imgui \
+  ../src/test_solanum.cc \
+  ../imgui/imgui.a \
+  -o test_solanum
+
+./test_solanum